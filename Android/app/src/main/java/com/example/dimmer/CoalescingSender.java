@@ -0,0 +1,108 @@
+package com.example.dimmer;
+
+/**
+ * Sends the brightness to the dimmer with at most one request in flight.
+ *
+ * Values set while a request is in flight replace each other and only the
+ * latest one is sent once the request completes, so a moving slider never
+ * queues behind outdated values. Not thread safe, must be used from the
+ * main thread, where Volley delivers its responses.
+ */
+public class CoalescingSender {
+    /**
+     * Sends a single value, and reports its completion on the main thread.
+     */
+    public interface Transport {
+        void send(int value, Listener listener);
+    }
+
+    /**
+     * Completion of a request.
+     */
+    public interface Listener {
+        void onResponse(String response);
+
+        void onError();
+    }
+
+    private final Transport transport;
+    private final Listener listener;
+
+    // Value of the request in flight, and the latest one set after it.
+    private boolean isSending = false;
+    private int sendingValue;
+    private boolean hasPending = false;
+    private int pendingValue;
+
+    /**
+     * @param transport Sends the values.
+     * @param listener Gets the completion of the latest value only, the
+     *                 responses to the values replaced meanwhile are dropped.
+     */
+    public CoalescingSender(Transport transport, Listener listener) {
+        this.transport = transport;
+        this.listener = listener;
+    }
+
+    /**
+     * Sends a value now, or once the request in flight completes.
+     *
+     * @param value Value to send.
+     */
+    public void send(int value) {
+        if (!isSending) {
+            start(value);
+            return;
+        }
+
+        // The request in flight already carries it.
+        hasPending = value != sendingValue;
+        pendingValue = value;
+    }
+
+    /**
+     * @return true while a request is in flight.
+     */
+    public boolean isSending() {
+        return isSending;
+    }
+
+    private void start(int value) {
+        isSending = true;
+        sendingValue = value;
+
+        transport.send(value, new Listener() {
+            @Override
+            public void onResponse(String response) {
+                if (!sendPending()) {
+                    listener.onResponse(response);
+                }
+            }
+
+            @Override
+            public void onError() {
+                if (!sendPending()) {
+                    listener.onError();
+                }
+            }
+        });
+    }
+
+    /**
+     * Completes the request in flight, and sends the latest value if any.
+     *
+     * @return true if a newer value was sent.
+     */
+    private boolean sendPending() {
+        isSending = false;
+
+        if (!hasPending) {
+            return false;
+        }
+
+        hasPending = false;
+        start(pendingValue);
+
+        return true;
+    }
+}
@@ -0,0 +1,130 @@
+package com.example.dimmer;
+
+import android.content.Context;
+import android.net.nsd.NsdManager;
+import android.net.nsd.NsdServiceInfo;
+import android.os.Handler;
+import android.os.Looper;
+
+import java.net.Inet6Address;
+import java.net.InetAddress;
+import java.util.concurrent.atomic.AtomicBoolean;
+
+/**
+ * Finds a dimmer on the local network from the _dimmer._udp service it
+ * advertises over mDNS, as dimmer-XXXXXX.local, in station and SoftAP mode.
+ * The first dimmer resolved is reported on the main thread.
+ */
+public class DimmerDiscovery {
+    /**
+     * Address of a dimmer found on the network.
+     */
+    public interface Listener {
+        void onFound(String host);
+    }
+
+    private static final String SERVICE_TYPE = "_dimmer._udp.";
+
+    private final NsdManager nsdManager;
+    private final Listener listener;
+    private final Handler handler = new Handler(Looper.getMainLooper());
+
+    // Only one service is resolved at a time.
+    private final AtomicBoolean isResolving = new AtomicBoolean(false);
+    private NsdManager.DiscoveryListener discoveryListener;
+
+    /**
+     * @param context Context of the system service.
+     * @param listener Gets the address of the dimmer on the main thread.
+     */
+    public DimmerDiscovery(Context context, Listener listener) {
+        this.nsdManager = (NsdManager) context.getSystemService(Context.NSD_SERVICE);
+        this.listener = listener;
+    }
+
+    /**
+     * Starts looking for a dimmer, until stop() is called.
+     */
+    public void start() {
+        if (discoveryListener != null) {
+            return;
+        }
+
+        discoveryListener = new NsdManager.DiscoveryListener() {
+            @Override
+            public void onDiscoveryStarted(String serviceType) {
+            }
+
+            @Override
+            public void onServiceFound(NsdServiceInfo serviceInfo) {
+                if (isResolving.compareAndSet(false, true)) {
+                    nsdManager.resolveService(serviceInfo, new ResolveListener());
+                }
+            }
+
+            @Override
+            public void onServiceLost(NsdServiceInfo serviceInfo) {
+            }
+
+            @Override
+            public void onDiscoveryStopped(String serviceType) {
+            }
+
+            @Override
+            public void onStartDiscoveryFailed(String serviceType, int errorCode) {
+            }
+
+            @Override
+            public void onStopDiscoveryFailed(String serviceType, int errorCode) {
+            }
+        };
+
+        nsdManager.discoverServices(SERVICE_TYPE, NsdManager.PROTOCOL_DNS_SD,
+                discoveryListener);
+    }
+
+    /**
+     * Stops looking for a dimmer, the last address found stays valid.
+     */
+    public void stop() {
+        if (discoveryListener == null) {
+            return;
+        }
+
+        try {
+            nsdManager.stopServiceDiscovery(discoveryListener);
+        } catch (IllegalArgumentException e) {
+            // The discovery failed to start, nothing to stop.
+        }
+
+        discoveryListener = null;
+    }
+
+    /**
+     * Reports the address of a resolved dimmer, a new listener is needed for
+     * every resolution.
+     */
+    private class ResolveListener implements NsdManager.ResolveListener {
+        @Override
+        public void onServiceResolved(NsdServiceInfo serviceInfo) {
+            isResolving.set(false);
+
+            final InetAddress address = serviceInfo.getHost();
+            final String host = (address instanceof Inet6Address)
+                    ? "[" + address.getHostAddress() + "]"
+                    : address.getHostAddress();
+
+            handler.post(new Runnable() {
+                @Override
+                public void run() {
+                    listener.onFound(host);
+                }
+            });
+        }
+
+        @Override
+        public void onResolveFailed(NsdServiceInfo serviceInfo, int errorCode) {
+            isResolving.set(false);
+        }
+    }
+}
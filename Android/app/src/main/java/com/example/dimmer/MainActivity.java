@@ -6,6 +6,7 @@ import android.os.Bundle;
 import android.widget.SeekBar;
 import android.widget.TextView;
 
+import com.android.volley.DefaultRetryPolicy;
 import com.android.volley.Request;
 import com.android.volley.RequestQueue;
 import com.android.volley.Response;
@@ -14,9 +15,18 @@ import com.android.volley.toolbox.StringRequest;
 import com.android.volley.toolbox.Volley;
 
 public class MainActivity extends AppCompatActivity {
+    // Time before a request is given up, the next value is sent instead.
+    static final int REQUEST_TIMEOUT_MS = 1000;
+
+    // Address of the dimmer SoftAP, used until a dimmer is found over mDNS.
+    static final String SOFTAP_HOST = "192.168.1.1";
+
     SeekBar seekBar;
     TextView brightness;
     RequestQueue requestQueue;
+    CoalescingSender sender;
+    DimmerDiscovery discovery;
+    String host = SOFTAP_HOST;
     String url;
     Integer progress;
 
@@ -32,11 +42,72 @@ public class MainActivity extends AppCompatActivity {
         // Creates a new request Queue.
         requestQueue = Volley.newRequestQueue(this);
 
+        // Follows the dimmer once it joined the network as a station.
+        discovery = new DimmerDiscovery(this, new DimmerDiscovery.Listener() {
+            @Override
+            public void onFound(String found) {
+                host = found;
+            }
+        });
+
+        // Sends the latest brightness only, with one request in flight.
+        sender = new CoalescingSender(
+                new CoalescingSender.Transport() {
+                    @Override
+                    public void send(int value, CoalescingSender.Listener listener) {
+                        // Adds URL parameter
+                        url = "http://" + host + "/?brightness=" + String.valueOf(value);
+
+                        // Requests a string response from the provided URL
+                        StringRequest stringRequest = new StringRequest(
+                                Request.Method.GET,
+                                url,
+                                new Response.Listener<String>() {
+                                    @Override
+                                    public void onResponse(String response) {
+                                        listener.onResponse(response);
+                                    }
+                                },
+                                new Response.ErrorListener() {
+                                    @Override
+                                    public void onErrorResponse(VolleyError error) {
+                                        listener.onError();
+                                    }
+                                }
+                        );
+
+                        // A newer value replaces a lost one, never retry it.
+                        stringRequest.setRetryPolicy(new DefaultRetryPolicy(
+                                REQUEST_TIMEOUT_MS, 0,
+                                DefaultRetryPolicy.DEFAULT_BACKOFF_MULT));
+
+                        requestQueue.add(stringRequest);
+                    }
+                },
+                new CoalescingSender.Listener() {
+                    @Override
+                    public void onResponse(String response) {
+                        // Displays the response string
+                        brightness.setText(response);
+                    }
+
+                    @Override
+                    public void onError() {
+                        brightness.setText("Connection error!");
+                    }
+                }
+        );
+
         seekBar.setOnSeekBarChangeListener(new SeekBar.OnSeekBarChangeListener() {
             @Override
             public void onProgressChanged(SeekBar seekBar, int i, boolean b) {
                 progress = i;
                 brightness.setText(String.valueOf(progress));
+
+                // Follows the slider while it moves.
+                if (b) {
+                    sender.send(progress);
+                }
             }
 
             @Override
@@ -46,30 +117,21 @@ public class MainActivity extends AppCompatActivity {
 
             @Override
             public void onStopTrackingTouch(SeekBar seekBar) {
-                // Adds URL parameter
-                url = "http://192.168.1.1/?brightness=" + String.valueOf(progress);
-
-                // Requests a string response from the provided URL
-                StringRequest stringRequest = new StringRequest(
-                        Request.Method.GET, 
-                        url,
-                        new Response.Listener<String>() {
-                            @Override
-                            public void onResponse(String response) {
-                                // Displays the response string
-                                brightness.setText(response);
-                            }
-                        }, 
-                        new Response.ErrorListener() {
-                            @Override
-                            public void onErrorResponse(VolleyError error) {
-                                brightness.setText("Connection error!");
-                            }
-                        }
-                );
-
-                requestQueue.add(stringRequest);
+                // The last value is already sent, or sent once the request
+                // in flight completes.
             }
         });
     }
-}
\ No newline at end of file
+
+    @Override
+    protected void onStart() {
+        super.onStart();
+        discovery.start();
+    }
+
+    @Override
+    protected void onStop() {
+        discovery.stop();
+        super.onStop();
+    }
+}
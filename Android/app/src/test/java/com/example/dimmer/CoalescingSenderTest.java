@@ -0,0 +1,118 @@
+package com.example.dimmer;
+
+import org.junit.Before;
+import org.junit.Test;
+
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
+import static org.junit.Assert.*;
+
+/**
+ * Local unit test of the brightness sender, with a transport completing the
+ * requests on demand.
+ */
+public class CoalescingSenderTest {
+    private final List<Integer> sent = new ArrayList<>();
+    private final List<CoalescingSender.Listener> inFlight = new ArrayList<>();
+    private final List<String> responses = new ArrayList<>();
+    private int errors;
+    private CoalescingSender sender;
+
+    @Before
+    public void setUp() {
+        sender = new CoalescingSender(
+                new CoalescingSender.Transport() {
+                    @Override
+                    public void send(int value, CoalescingSender.Listener listener) {
+                        sent.add(value);
+                        inFlight.add(listener);
+                    }
+                },
+                new CoalescingSender.Listener() {
+                    @Override
+                    public void onResponse(String response) {
+                        responses.add(response);
+                    }
+
+                    @Override
+                    public void onError() {
+                        errors++;
+                    }
+                });
+    }
+
+    private void respond() {
+        inFlight.remove(0).onResponse(String.valueOf(sent.get(sent.size() - 1)));
+    }
+
+    @Test
+    public void sendsRightAwayWhenIdle() {
+        sender.send(10);
+
+        assertEquals(Arrays.asList(10), sent);
+        assertTrue(sender.isSending());
+    }
+
+    @Test
+    public void keepsOneRequestInFlight() {
+        sender.send(10);
+        sender.send(20);
+        sender.send(30);
+
+        assertEquals(1, inFlight.size());
+        assertEquals(Arrays.asList(10), sent);
+    }
+
+    @Test
+    public void sendsOnlyTheLatestValue() {
+        sender.send(10);
+        sender.send(20);
+        sender.send(30);
+        respond();
+
+        assertEquals(Arrays.asList(10, 30), sent);
+
+        respond();
+
+        assertEquals(Arrays.asList(10, 30), sent);
+        assertFalse(sender.isSending());
+    }
+
+    @Test
+    public void reportsOnlyTheLatestResponse() {
+        sender.send(10);
+        sender.send(20);
+        respond();
+        respond();
+
+        assertEquals(Arrays.asList("20"), responses);
+    }
+
+    @Test
+    public void skipsTheValueAlreadyInFlight() {
+        sender.send(10);
+        sender.send(20);
+        sender.send(10);
+        respond();
+
+        assertEquals(Arrays.asList(10), sent);
+        assertFalse(sender.isSending());
+    }
+
+    @Test
+    public void sendsTheLatestValueAfterAnError() {
+        sender.send(10);
+        sender.send(20);
+        inFlight.remove(0).onError();
+
+        assertEquals(Arrays.asList(10, 20), sent);
+        assertEquals(0, errors);
+
+        inFlight.remove(0).onError();
+
+        assertEquals(1, errors);
+        assertFalse(sender.isSending());
+    }
+}
@@ -0,0 +1,301 @@
+#include "hal_host.h"
+#include <stdbool.h>
+#include <time.h>
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "driver/mcpwm_prelude.h"
+#include "firing.h"
+#include "freertos/task.h"
+#include "mains_watchdog.h"
+#include "power_profile.h"
+
+/* Same timing constants as the firing engine of the firmware */
+#define HAL_HOST_TIMER_PERIOD_US 40000
+#define HAL_HOST_GATE_GUARD_US 200
+#define HAL_HOST_MIN_DELAY_US 100
+
+/* Clock of the capture counter, the APB clock of the firmware */
+#define HAL_HOST_CAPTURE_RESOLUTION_HZ 80000000
+#define HAL_HOST_CAPTURE_TICKS_PER_US (HAL_HOST_CAPTURE_RESOLUTION_HZ / 1000000)
+
+/**
+ * @brief Simulated state of a firing channel.
+ */
+typedef struct {
+    /* Fire compare in use, and the one latched on the next reset */
+    uint32_t delay;
+    uint32_t pending_delay;
+    bool is_pending;
+
+    /* Flag holding whether the gate output is forced low */
+    bool is_forced;
+
+    /* Time of the next compare match */
+    uint64_t next_fire;
+} hal_host_channel_t;
+
+static hal_host_channel_t channels[FIRING_MAX_CHANNELS];
+static size_t channel_count = 0;
+
+/* Time of the last timer reset */
+static uint64_t sync_time = 0;
+
+/* Simulated time */
+static uint64_t current_time = 0;
+
+static hal_host_fire_callback_t fire_callback;
+
+/* Edge watchdog, its next timeout and its reload, 0 while idle */
+static mains_watchdog_callback_t watchdog_callback;
+static uint64_t watchdog_deadline = 0;
+static uint32_t watchdog_timeout = 0;
+
+/* Capture channel, its callback and the time its counter started at */
+static mcpwm_capture_event_cb_t capture_callback;
+static uint64_t capture_start = 0;
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)current_time;
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (esp_cpu_cycle_count_t)(now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+}
+
+void hal_host_set_time(uint64_t now)
+{
+    current_time = now;
+}
+
+void hal_host_firing_reset(hal_host_fire_callback_t callback)
+{
+    fire_callback = callback;
+    sync_time = 0;
+    current_time = 0;
+    channel_count = 0;
+    watchdog_callback = NULL;
+    watchdog_deadline = 0;
+    capture_callback = NULL;
+}
+
+/**
+ * @brief Reports the compare matches before a time.
+ *
+ * @param time Time in microseconds.
+ *
+ * @return void
+ */
+static void hal_host_fire_until(uint64_t time)
+{
+    for (size_t i = 0; i < channel_count; i++) {
+        hal_host_channel_t *channel = &channels[i];
+
+        if (sync_time == 0 || channel->is_forced) {
+            continue;
+        }
+
+        /* The compare matches again after every wrap of the counter */
+        while (channel->next_fire < time) {
+            fire_callback(i, channel->next_fire);
+            channel->next_fire += HAL_HOST_TIMER_PERIOD_US;
+        }
+    }
+}
+
+void hal_host_firing_advance(uint64_t time)
+{
+    /* The timeouts of the watchdog come in order with the triggers */
+    while (watchdog_deadline != 0 && watchdog_deadline <= time) {
+        const uint64_t deadline = watchdog_deadline;
+
+        hal_host_fire_until(deadline);
+
+        /* The alarm reloads, it fires again until the next feed */
+        watchdog_deadline += watchdog_timeout;
+        current_time = deadline;
+
+        watchdog_callback();
+    }
+
+    hal_host_fire_until(time);
+}
+
+void hal_host_firing_sync(uint64_t time)
+{
+    hal_host_firing_advance(time);
+
+    sync_time = time;
+
+    for (size_t i = 0; i < channel_count; i++) {
+        hal_host_channel_t *channel = &channels[i];
+
+        if (channel->is_pending) {
+            channel->delay = channel->pending_delay;
+            channel->is_pending = false;
+        }
+
+        channel->next_fire = sync_time + channel->delay;
+    }
+}
+
+bool hal_host_capture(uint64_t time, bool level)
+{
+    if (capture_callback == NULL) {
+        return false;
+    }
+
+    /* The 32-bit counter wraps every 53.7 s, as on the chip */
+    const mcpwm_capture_event_data_t edata = {
+        .cap_value = (uint32_t)((time - capture_start) *
+                                HAL_HOST_CAPTURE_TICKS_PER_US),
+        .cap_edge = level ? MCPWM_CAP_EDGE_POS : MCPWM_CAP_EDGE_NEG,
+    };
+
+    return capture_callback(NULL, &edata, NULL);
+}
+
+esp_err_t mcpwm_new_capture_timer(const mcpwm_capture_timer_config_t *config,
+                                  mcpwm_cap_timer_handle_t *ret_cap_timer)
+{
+    *ret_cap_timer = NULL;
+
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_capture_timer_get_resolution(mcpwm_cap_timer_handle_t timer,
+                                             uint32_t *out_resolution)
+{
+    *out_resolution = HAL_HOST_CAPTURE_RESOLUTION_HZ;
+
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_new_capture_channel(
+    mcpwm_cap_timer_handle_t timer,
+    const mcpwm_capture_channel_config_t *config,
+    mcpwm_cap_channel_handle_t *ret_cap_channel)
+{
+    *ret_cap_channel = NULL;
+
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_capture_channel_register_event_callbacks(
+    mcpwm_cap_channel_handle_t channel,
+    const mcpwm_capture_event_callbacks_t *cbs, void *user_data)
+{
+    capture_callback = cbs->on_cap;
+
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_capture_channel_enable(mcpwm_cap_channel_handle_t channel)
+{
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_capture_timer_enable(mcpwm_cap_timer_handle_t timer)
+{
+    return ESP_OK;
+}
+
+esp_err_t mcpwm_capture_timer_start(mcpwm_cap_timer_handle_t timer)
+{
+    capture_start = current_time;
+
+    return ESP_OK;
+}
+
+int power_profile_intr_priority(void)
+{
+    return 1;
+}
+
+void firing_init(gpio_num_t sync_pin, const gpio_num_t *gate_pins,
+                 size_t count)
+{
+    channel_count = (count > FIRING_MAX_CHANNELS) ? FIRING_MAX_CHANNELS
+                                                  : count;
+
+    for (size_t i = 0; i < channel_count; i++) {
+        channels[i] = (hal_host_channel_t){ .is_forced = true };
+    }
+}
+
+size_t firing_channel_count(void)
+{
+    return channel_count;
+}
+
+void firing_set_delay(size_t index, uint32_t delay, uint32_t end)
+{
+    if (index >= channel_count) {
+        return;
+    }
+
+    hal_host_channel_t *channel = &channels[index];
+
+    if (delay < HAL_HOST_MIN_DELAY_US) {
+        delay = HAL_HOST_MIN_DELAY_US;
+    }
+
+    /* Same dead zone as the firing engine, the gate is forced low */
+    if (end <= HAL_HOST_GATE_GUARD_US || end >= HAL_HOST_TIMER_PERIOD_US ||
+        delay >= end - HAL_HOST_GATE_GUARD_US) {
+        channel->is_forced = true;
+        return;
+    }
+
+    /* Matches passed while the gate was forced low never fire */
+    if (channel->is_forced) {
+        channel->is_forced = false;
+
+        while (channel->next_fire < current_time) {
+            channel->next_fire += HAL_HOST_TIMER_PERIOD_US;
+        }
+    }
+
+#if CONFIG_DIMMER_ISR_SCHEDULING
+    /* Applied immediately, a compare already passed waits for the wrap */
+    channel->delay = delay;
+    channel->next_fire = sync_time + delay;
+
+    while (channel->next_fire < current_time) {
+        channel->next_fire += HAL_HOST_TIMER_PERIOD_US;
+    }
+#else
+    channel->pending_delay = delay;
+    channel->is_pending = true;
+#endif
+}
+
+void firing_set_pulse(size_t index, const firing_pulse_t *pulse)
+{
+}
+
+#if CONFIG_DIMMER_MAINS_WATCHDOG
+void mains_watchdog_init(mains_watchdog_callback_t callback)
+{
+    watchdog_callback = callback;
+}
+
+void mains_watchdog_feed(uint32_t timeout)
+{
+    if (watchdog_callback == NULL) {
+        return;
+    }
+
+    watchdog_timeout = timeout;
+    watchdog_deadline = current_time + timeout;
+}
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Callback called for every simulated gate trigger.
+ *
+ * @param channel Index of the channel.
+ * @param time Time of the trigger in microseconds.
+ */
+typedef void (*hal_host_fire_callback_t)(size_t channel, uint64_t time);
+
+/**
+ * @brief Sets the simulated time returned by esp_timer_get_time().
+ *
+ * @param now Time in microseconds.
+ *
+ * @return void
+ */
+void hal_host_set_time(uint64_t now);
+
+/**
+ * @brief Resets the simulated firing engine.
+ *
+ * The engine models the MCPWM timers of the firmware: a free running 1 MHz
+ * counter reset by every rising edge of the input, wrapping at 40 ms, and
+ * a fire compare per channel applied immediately with ISR scheduling and
+ * latched on the next reset otherwise.
+ *
+ * @param callback Function called for every trigger.
+ *
+ * @return void
+ */
+void hal_host_firing_reset(hal_host_fire_callback_t callback);
+
+/**
+ * @brief Resets the timers on a rising edge of the input.
+ *
+ * Must be called before the edge is handed to the firmware, as the hardware
+ * resets the timers before the ISR runs.
+ *
+ * @param time Time of the edge in microseconds.
+ *
+ * @return void
+ */
+void hal_host_firing_sync(uint64_t time);
+
+/**
+ * @brief Reports the triggers that happen up to a time.
+ *
+ * The timeouts of the edge watchdog in between are handed to the callback
+ * of mains_watchdog_init(), at their time and in order with the triggers.
+ *
+ * @param time Time in microseconds.
+ *
+ * @return void
+ */
+void hal_host_firing_advance(uint64_t time);
+
+/**
+ * @brief Latches an edge of the input on the simulated capture channel.
+ *
+ * The channel models the MCPWM capture timer of the firmware, a free
+ * running 32-bit counter at 80 MHz started by edge_capture_init(), and
+ * hands the counter value to the capture callback as the ISR does. The
+ * simulated time must already be set past the edge, by the ISR latency.
+ *
+ * @param time Time of the edge in microseconds.
+ * @param level Level of the input after the edge.
+ *
+ * @return Value returned by the capture callback, false without one.
+ */
+bool hal_host_capture(uint64_t time, bool level);
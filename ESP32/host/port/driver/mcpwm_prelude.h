@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+/* Only the capture part of the MCPWM driver, faked by the host HAL */
+typedef struct hal_host_capture *mcpwm_cap_timer_handle_t;
+typedef struct hal_host_capture *mcpwm_cap_channel_handle_t;
+
+typedef enum {
+    MCPWM_CAP_EDGE_POS,
+    MCPWM_CAP_EDGE_NEG,
+} mcpwm_capture_edge_t;
+
+typedef enum {
+    MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+} mcpwm_capture_clock_source_t;
+
+typedef struct {
+    uint32_t cap_value;
+    mcpwm_capture_edge_t cap_edge;
+} mcpwm_capture_event_data_t;
+
+typedef bool (*mcpwm_capture_event_cb_t)(
+    mcpwm_cap_channel_handle_t channel,
+    const mcpwm_capture_event_data_t *edata, void *user_data);
+
+typedef struct {
+    int group_id;
+    mcpwm_capture_clock_source_t clk_src;
+} mcpwm_capture_timer_config_t;
+
+typedef struct {
+    gpio_num_t gpio_num;
+    int intr_priority;
+    uint32_t prescale;
+    struct {
+        uint32_t pos_edge : 1;
+        uint32_t neg_edge : 1;
+        uint32_t io_loop_back : 1;
+    } flags;
+} mcpwm_capture_channel_config_t;
+
+typedef struct {
+    mcpwm_capture_event_cb_t on_cap;
+} mcpwm_capture_event_callbacks_t;
+
+esp_err_t mcpwm_new_capture_timer(const mcpwm_capture_timer_config_t *config,
+                                  mcpwm_cap_timer_handle_t *ret_cap_timer);
+esp_err_t mcpwm_capture_timer_get_resolution(mcpwm_cap_timer_handle_t timer,
+                                             uint32_t *out_resolution);
+esp_err_t mcpwm_new_capture_channel(
+    mcpwm_cap_timer_handle_t timer,
+    const mcpwm_capture_channel_config_t *config,
+    mcpwm_cap_channel_handle_t *ret_cap_channel);
+esp_err_t mcpwm_capture_channel_register_event_callbacks(
+    mcpwm_cap_channel_handle_t channel,
+    const mcpwm_capture_event_callbacks_t *cbs, void *user_data);
+esp_err_t mcpwm_capture_channel_enable(mcpwm_cap_channel_handle_t channel);
+esp_err_t mcpwm_capture_timer_enable(mcpwm_cap_timer_handle_t timer);
+esp_err_t mcpwm_capture_timer_start(mcpwm_cap_timer_handle_t timer);
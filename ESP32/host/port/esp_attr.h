@@ -0,0 +1,5 @@
+#pragma once
+
+/* Code and data placement has no meaning on the host */
+#define IRAM_ATTR
+#define DRAM_ATTR
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+/**
+ * @brief Gets the host clock in nanoseconds, standing for the cycle count.
+ *
+ * @return Nanoseconds of the monotonic clock, wrapping at 32 bits.
+ */
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
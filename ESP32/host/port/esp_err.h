@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+/* Only the codes used by the firmware sources of the host build */
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+/* Every fake of the host HAL succeeds */
+#define ESP_ERROR_CHECK(x) ((void)(x))
@@ -0,0 +1,4 @@
+#pragma once
+
+/* Only the handle type, the HTTP server is not part of the host build */
+typedef void *httpd_handle_t;
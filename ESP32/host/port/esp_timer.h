@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Gets the simulated time.
+ *
+ * @return Time set by hal_host_set_time() in microseconds.
+ */
+int64_t esp_timer_get_time(void);
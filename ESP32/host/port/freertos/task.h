@@ -0,0 +1,12 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * @brief Yields to the other tasks, nothing to wait for on the host.
+ *
+ * @param ticks Not used in this implementation.
+ *
+ * @return void
+ */
+void vTaskDelay(TickType_t ticks);
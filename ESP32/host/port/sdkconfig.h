@@ -0,0 +1,16 @@
+#pragma once
+
+/* Configuration of the host build, each target may override it */
+#ifndef CONFIG_DIMMER_CHANNEL_COUNT
+#define CONFIG_DIMMER_CHANNEL_COUNT 3
+#endif
+
+#ifndef CONFIG_DIMMER_ISR_SCHEDULING
+#define CONFIG_DIMMER_ISR_SCHEDULING 1
+#endif
+
+#ifndef CONFIG_DIMMER_MAINS_WATCHDOG
+#define CONFIG_DIMMER_MAINS_WATCHDOG 1
+#endif
+
+/* Metrics, HTTP and radio are left out, their hooks compile to nothing */
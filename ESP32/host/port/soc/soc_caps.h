@@ -0,0 +1,5 @@
+#pragma once
+
+/* MCPWM of the ESP32 */
+#define SOC_MCPWM_GROUPS 2
+#define SOC_MCPWM_OPERATORS_PER_GROUP 3
@@ -0,0 +1,667 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dimmer_state.h"
+#include "edge_capture.h"
+#include "esp_timer.h"
+#include "firing.h"
+#include "hal_host.h"
+#include "mains_watchdog.h"
+#include "phase_lut.h"
+#include "trace.h"
+#include "zero_crossing.h"
+
+/* Number of TRIAC channels driven from the zero-crossing input */
+#define CHANNEL_COUNT CONFIG_DIMMER_CHANNEL_COUNT
+
+/* Time from the edge to the ISR and to the control task in microseconds */
+#define SIM_ISR_LATENCY_US 5
+#define SIM_TASK_LATENCY_US 150
+
+/* Zero-crossings skipped after the lock before the coverage is counted */
+#define SIM_SETTLE_CROSSINGS 8
+
+/* Shape of the detector output of this build, and firing windows per edge */
+#if CONFIG_DIMMER_FIRE_BOTH_HALVES
+#define SIM_DETECTOR TRACE_DETECTOR_SQUARE
+#define SIM_DETECTOR_WIDTH_US 300
+#define SIM_WINDOWS_PER_EDGE 2
+#else
+#define SIM_DETECTOR TRACE_DETECTOR_PULSE
+#define SIM_DETECTOR_WIDTH_US 600
+#define SIM_WINDOWS_PER_EDGE 1
+#endif
+
+/* Rising edges still fired at the old period after a frequency step, until
+ * the tracker drops the lock, plus the cycle latched ahead in task mode */
+#define SIM_STEP_EDGES 4
+
+/* Triggers allowed off the zero-crossing after a frequency step */
+#define SIM_STEP_BAD (SIM_STEP_EDGES * SIM_WINDOWS_PER_EDGE * CHANNEL_COUNT)
+
+/**
+ * @brief Synthetic scenario and the bounds it must stay within.
+ */
+typedef struct {
+    const char *name;
+    trace_config_t trace;
+
+    /* Largest error of a trigger counted as correct in microseconds */
+    uint32_t tolerance;
+
+    /* Most triggers outside the tolerance */
+    size_t max_bad;
+
+    /* Least share of the windows fired on every channel once locked */
+    double min_coverage;
+
+    /* Most rising edges to lock, and to lock again after the step or outage */
+    size_t max_lock_edges;
+    size_t max_relock_edges;
+
+    /* Most lock losses, besides the one of the step or outage */
+    size_t max_unlocks;
+} sim_scenario_t;
+
+/**
+ * @brief Results of a replay.
+ */
+typedef struct {
+    size_t fires;
+    size_t checked;
+    size_t bad;
+    size_t duplicates;
+    double coverage;
+
+    /* Edges handed to the firmware off their true time */
+    size_t timeline_errors;
+
+    /* Absolute errors of the checked triggers in microseconds */
+    uint32_t *errors;
+    uint32_t max_error;
+    uint32_t p99_error;
+
+    size_t lock_edges;
+    size_t relock_edges;
+    size_t unlocks;
+
+    double ns_per_edge;
+} sim_result_t;
+
+/* Trace of the detector of this build */
+#define SIM_TRACE(...)                                                    \
+    {                                                                     \
+        .pulse_width = SIM_DETECTOR_WIDTH_US, .detector = SIM_DETECTOR,   \
+        __VA_ARGS__                                                       \
+    }
+
+static const sim_scenario_t scenarios[] = {
+    {
+        .name = "steady-50",
+        .trace = SIM_TRACE(.frequency = 50, .duration = 30, .seed = 1),
+        .tolerance = 5,
+        .min_coverage = 0.999,
+        .max_lock_edges = 8,
+    },
+    {
+        .name = "steady-60",
+        .trace = SIM_TRACE(.frequency = 60, .duration = 30, .seed = 1),
+        .tolerance = 5,
+        .min_coverage = 0.999,
+        .max_lock_edges = 8,
+    },
+    {
+        .name = "noise",
+        .trace = SIM_TRACE(.frequency = 50, .noise = 40, .duration = 30,
+                           .seed = 7),
+        .tolerance = 150,
+        .min_coverage = 0.999,
+        .max_lock_edges = 16,
+    },
+    {
+        .name = "drift",
+        .trace = SIM_TRACE(.frequency = 49, .drift = 0.1, .duration = 20,
+                           .noise = 10, .seed = 3),
+        .tolerance = 60,
+        .min_coverage = 0.999,
+        .max_lock_edges = 16,
+    },
+    {
+        .name = "switch-50-60",
+        .trace = SIM_TRACE(.frequency = 50, .switch_time = 10,
+                           .switch_frequency = 60, .duration = 20,
+                           .seed = 1),
+        .tolerance = 5,
+        .max_bad = SIM_STEP_BAD,
+        .min_coverage = 0.99,
+        .max_lock_edges = 8,
+        .max_relock_edges = 12,
+    },
+    {
+        .name = "switch-60-50",
+        .trace = SIM_TRACE(.frequency = 60, .switch_time = 10,
+                           .switch_frequency = 50, .duration = 20,
+                           .seed = 1),
+        .tolerance = 5,
+        .max_bad = SIM_STEP_BAD,
+        .min_coverage = 0.99,
+        .max_lock_edges = 8,
+        .max_relock_edges = 12,
+    },
+    {
+        .name = "glitches",
+        .trace = SIM_TRACE(.frequency = 50, .glitch_rate = 0.02,
+                           .duration = 30, .seed = 5),
+        .tolerance = 5,
+        .min_coverage = 0.95,
+        .max_lock_edges = 8,
+    },
+    {
+        .name = "missing",
+        .trace = SIM_TRACE(.frequency = 50, .missing_rate = 0.02,
+                           .duration = 30, .seed = 9),
+        .tolerance = 5,
+        .min_coverage = 0.95,
+        .max_lock_edges = 8,
+    },
+    {
+        .name = "outage",
+        .trace = SIM_TRACE(.frequency = 50, .outage_time = 10,
+                           .outage_duration = 0.5, .duration = 20,
+                           .noise = 10, .seed = 11),
+        .tolerance = 60,
+        .min_coverage = 0.95,
+        .max_lock_edges = 16,
+        .max_relock_edges = 3,
+    },
+    {
+        /* Longer than one wrap of the 32-bit capture counter, 53.7 s */
+        .name = "long-outage",
+        .trace = SIM_TRACE(.frequency = 50, .outage_time = 5,
+                           .outage_duration = 60, .duration = 75,
+                           .noise = 10, .seed = 13),
+        .tolerance = 60,
+        .min_coverage = 0.95,
+        .max_lock_edges = 16,
+        .max_relock_edges = 3,
+    },
+};
+
+#define SIM_SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+/* Trace replayed and the results being gathered */
+static const trace_t *sim_trace;
+static sim_result_t *sim_result;
+static size_t error_capacity;
+
+/* Last zero-crossing fired on each channel, SIZE_MAX for none */
+static size_t fired_crossing[CHANNEL_COUNT];
+static size_t fired_windows[CHANNEL_COUNT];
+
+/* First zero-crossing counted for the coverage, SIZE_MAX before the lock */
+static size_t first_counted;
+
+/* True time of the edge being captured */
+static uint64_t edge_time;
+
+/**
+ * @brief Finds the last zero-crossing at or before a time.
+ *
+ * @param time Time in microseconds.
+ *
+ * @return Index of the zero-crossing, SIZE_MAX if none.
+ */
+static size_t sim_find_crossing(uint64_t time)
+{
+    size_t low = 0;
+    size_t high = sim_trace->crossing_count;
+
+    while (low < high) {
+        const size_t middle = (low + high) / 2;
+
+        if (sim_trace->crossings[middle] <= time) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return (low == 0) ? SIZE_MAX : low - 1;
+}
+
+/**
+ * @brief Checks a trigger against the true zero-crossing of its window.
+ *
+ * @param channel Index of the channel.
+ * @param time Time of the trigger in microseconds.
+ *
+ * @return void
+ */
+static void sim_on_fire(size_t channel, uint64_t time)
+{
+    sim_result->fires++;
+
+    if (sim_trace->crossing_count == 0) {
+        return;
+    }
+
+    const size_t crossing = sim_find_crossing(time);
+
+    /* Before the first or after the last zero-crossing, never expected */
+    if (crossing == SIZE_MAX || crossing + 1 >= sim_trace->crossing_count) {
+        sim_result->bad++;
+        return;
+    }
+
+    const uint64_t start = sim_trace->crossings[crossing];
+    const uint32_t window =
+        (uint32_t)(sim_trace->crossings[crossing + 1] - start);
+    const uint64_t expected =
+        start + phase_lut_delay(channel, dimmer_state_get_level(channel),
+                                window);
+    const int64_t difference = (int64_t)(time - expected);
+    const uint32_t error =
+        (uint32_t)((difference < 0) ? -difference : difference);
+
+    if (sim_result->checked == error_capacity) {
+        error_capacity = error_capacity * 2 + 4096;
+        sim_result->errors =
+            realloc(sim_result->errors, error_capacity * sizeof(uint32_t));
+    }
+
+    sim_result->errors[sim_result->checked++] = error;
+
+    if (error > sim_result->max_error) {
+        sim_result->max_error = error;
+    }
+
+    if (fired_crossing[channel] == crossing) {
+        sim_result->duplicates++;
+        return;
+    }
+
+    fired_crossing[channel] = crossing;
+
+    if (first_counted != SIZE_MAX && crossing >= first_counted) {
+        fired_windows[channel]++;
+    }
+}
+
+/**
+ * @brief Checks the timestamp of a captured edge and hands it on.
+ *
+ * @param time Timestamp of the edge from the capture timeline.
+ * @param is_rising true for a rising edge, false for a falling edge.
+ *
+ * @return Value returned by the edge processing of the firmware.
+ */
+static bool sim_on_edge(uint64_t time, bool is_rising)
+{
+    if (time != edge_time) {
+        sim_result->timeline_errors++;
+    }
+
+    return zero_crossing_edge(time, is_rising);
+}
+
+/**
+ * @brief Handles a timeout of the edge watchdog.
+ *
+ * @return false, no task to wake on the host.
+ */
+static bool sim_on_timeout(void)
+{
+    if (zero_crossing_timeout()) {
+#if !CONFIG_DIMMER_ISR_SCHEDULING
+        hal_host_set_time(esp_timer_get_time() + SIM_TASK_LATENCY_US);
+        zero_crossing_schedule();
+#endif
+    }
+
+    return false;
+}
+
+/**
+ * @brief Orders two errors for qsort().
+ *
+ * @param a First error.
+ * @param b Second error.
+ *
+ * @return Negative, zero or positive as a is below, equal or above b.
+ */
+static int sim_compare(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Replays a trace through the edge processing of the firmware.
+ *
+ * @param trace Trace to replay.
+ * @param tolerance Largest error of a trigger counted as correct.
+ * @param result Results to fill, the errors are freed by the caller.
+ *
+ * @return void
+ */
+static void sim_run(const trace_t *trace, uint32_t tolerance,
+                    sim_result_t *result)
+{
+    static const gpio_num_t gate_pins[CHANNEL_COUNT] = { 0 };
+
+    *result = (sim_result_t){ 0 };
+    sim_trace = trace;
+    sim_result = result;
+    error_capacity = 0;
+    first_counted = SIZE_MAX;
+
+    hal_host_firing_reset(sim_on_fire);
+    firing_init(0, gate_pins, CHANNEL_COUNT);
+    zero_crossing_init();
+    mains_watchdog_init(sim_on_timeout);
+    edge_capture_init(0, sim_on_edge);
+
+    /* Spread the channels over the levels, the curves and two windows */
+    for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+        phase_lut_set_curve(channel, channel % PHASE_LUT_CURVE_MAX);
+        phase_lut_set_conduction(channel, (channel % 2) ? 200 : 0,
+                                 (channel % 2) ? 850
+                                               : PHASE_LUT_CONDUCTION_MAX);
+        dimmer_state_set_level(channel, (channel + 1) * PHASE_LUT_LEVEL_MAX /
+                                            (CHANNEL_COUNT + 1));
+        fired_crossing[channel] = SIZE_MAX;
+        fired_windows[channel] = 0;
+    }
+
+    bool was_locked = false;
+    bool has_locked = false;
+    bool is_relocking = false;
+    size_t rising_count = 0;
+    size_t event_rising = 0;
+    uint64_t busy_ns = 0;
+
+    for (size_t i = 0; i < trace->edge_count; i++) {
+        const trace_edge_t *edge = &trace->edges[i];
+        struct timespec begin, end;
+
+        /* The hardware resets the timers before the ISR even runs */
+        hal_host_firing_advance(edge->time);
+
+        if (edge->level) {
+            hal_host_firing_sync(edge->time);
+            rising_count++;
+
+            if (trace->event_time != 0 && event_rising == 0 &&
+                edge->time >= trace->event_time) {
+                event_rising = rising_count;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+
+        hal_host_set_time(edge->time + SIM_ISR_LATENCY_US);
+        edge_time = edge->time;
+
+        if (hal_host_capture(edge->time, edge->level)) {
+#if !CONFIG_DIMMER_ISR_SCHEDULING
+            hal_host_set_time(edge->time + SIM_TASK_LATENCY_US);
+            zero_crossing_schedule();
+#endif
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        busy_ns += (uint64_t)(end.tv_sec - begin.tv_sec) * 1000000000ULL +
+                   (uint64_t)(end.tv_nsec - begin.tv_nsec);
+
+        dimmer_edges_t edges;
+
+        dimmer_state_read_edges(&edges);
+
+        if (edges.is_locked && !has_locked) {
+            has_locked = true;
+            result->lock_edges = rising_count;
+
+            /* Count the windows once the estimate settled */
+            if (trace->crossing_count > 0) {
+                const size_t crossing = sim_find_crossing(edge->time);
+
+                first_counted = ((crossing == SIZE_MAX) ? 0 : crossing) +
+                                SIM_SETTLE_CROSSINGS;
+            }
+        }
+
+        if (was_locked && !edges.is_locked) {
+            result->unlocks++;
+
+            if (event_rising != 0 && result->relock_edges == 0) {
+                is_relocking = true;
+            }
+        }
+
+        if (is_relocking && edges.is_locked) {
+            is_relocking = false;
+            result->relock_edges = rising_count - event_rising;
+        }
+
+        was_locked = edges.is_locked;
+    }
+
+    if (trace->edge_count > 0) {
+        hal_host_firing_advance(trace->edges[trace->edge_count - 1].time);
+        result->ns_per_edge = (double)busy_ns / trace->edge_count;
+    }
+
+    /* Never locked again after the step */
+    if (is_relocking) {
+        result->relock_edges = SIZE_MAX;
+    }
+
+    if (result->checked > 0) {
+        for (size_t i = 0; i < result->checked; i++) {
+            if (result->errors[i] > tolerance) {
+                result->bad++;
+            }
+        }
+
+        qsort(result->errors, result->checked, sizeof(uint32_t), sim_compare);
+        result->p99_error = result->errors[result->checked * 99 / 100];
+    }
+
+    /* Share of the windows fired, a trigger too late for its window lands
+     * in the next one and is counted as an error instead */
+    if (first_counted != SIZE_MAX && trace->crossing_count > first_counted + 1) {
+        const size_t windows = trace->crossing_count - 1 - first_counted;
+        size_t fired = 0;
+
+        for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+            fired += fired_windows[channel];
+        }
+
+        result->coverage = (double)fired / (double)(windows * CHANNEL_COUNT);
+    }
+}
+
+/**
+ * @brief Replays a scenario and checks it against its bounds.
+ *
+ * @param scenario Scenario to replay.
+ * @param save_path Path to save the trace to, NULL to only replay it.
+ *
+ * @return true if the scenario passed.
+ */
+static bool sim_scenario(const sim_scenario_t *scenario, const char *save_path)
+{
+    trace_t trace;
+    sim_result_t result;
+
+    trace_generate(&scenario->trace, &trace);
+
+    if (save_path != NULL && !trace_save(save_path, &trace)) {
+        fprintf(stderr, "Cannot write %s\n", save_path);
+        trace_free(&trace);
+        return false;
+    }
+
+    sim_run(&trace, scenario->tolerance, &result);
+
+    const bool has_relock = scenario->trace.switch_time > 0 ||
+                            scenario->trace.outage_duration > 0;
+    const size_t event_unlocks = has_relock ? 1 : 0;
+    bool is_passed = true;
+
+    is_passed &= result.bad <= scenario->max_bad;
+    is_passed &= result.duplicates == 0;
+    is_passed &= result.timeline_errors == 0;
+    is_passed &= result.coverage >= scenario->min_coverage;
+    is_passed &= result.lock_edges != 0 &&
+                 result.lock_edges <= scenario->max_lock_edges;
+    is_passed &= result.unlocks <= scenario->max_unlocks + event_unlocks;
+
+    if (has_relock) {
+        is_passed &= result.relock_edges != 0 &&
+                     result.relock_edges <= scenario->max_relock_edges;
+    }
+
+    printf("%-14s %s fires %zu bad %zu dup %zu timeline %zu coverage %.4f "
+           "error max %u p99 %u us lock %zu",
+           scenario->name, is_passed ? "PASS" : "FAIL", result.fires,
+           result.bad, result.duplicates, result.timeline_errors,
+           result.coverage, result.max_error, result.p99_error,
+           result.lock_edges);
+
+    if (has_relock) {
+        if (result.relock_edges == SIZE_MAX) {
+            printf(" relock never");
+        } else {
+            printf(" relock %zu", result.relock_edges);
+        }
+    }
+
+    printf(" unlocks %zu %.0f ns/edge\n", result.unlocks, result.ns_per_edge);
+
+    free(result.errors);
+    trace_free(&trace);
+
+    return is_passed;
+}
+
+/**
+ * @brief Replays a recorded trace, without any true zero-crossing to check.
+ *
+ * @param path Path of the trace file.
+ *
+ * @return true if the trace was replayed and locked.
+ */
+static bool sim_recorded(const char *path)
+{
+    trace_t trace;
+    sim_result_t result;
+
+    if (!trace_load(path, &trace)) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return false;
+    }
+
+    sim_run(&trace, 0, &result);
+
+    printf("%s: edges %zu fires %zu lock %zu unlocks %zu %.0f ns/edge\n",
+           path, trace.edge_count, result.fires, result.lock_edges,
+           result.unlocks, result.ns_per_edge);
+
+    free(result.errors);
+    trace_free(&trace);
+
+    return result.lock_edges != 0;
+}
+
+/**
+ * @brief Finds a scenario by name.
+ *
+ * @param name Name of the scenario.
+ *
+ * @return Scenario, NULL if none has this name.
+ */
+static const sim_scenario_t *sim_find_scenario(const char *name)
+{
+    for (size_t i = 0; i < SIM_SCENARIO_COUNT; i++) {
+        if (strcmp(scenarios[i].name, name) == 0) {
+            return &scenarios[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Prints how to call the simulator.
+ *
+ * @param program Name of the program.
+ *
+ * @return void
+ */
+static void sim_usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [SCENARIO...]\n"
+            "       %s --list\n"
+            "       %s --trace FILE\n"
+            "       %s --save FILE SCENARIO\n",
+            program, program, program, program);
+}
+
+int main(int argc, char **argv)
+{
+    bool is_passed = true;
+
+    phase_lut_init();
+
+    if (argc == 2 && strcmp(argv[1], "--list") == 0) {
+        for (size_t i = 0; i < SIM_SCENARIO_COUNT; i++) {
+            printf("%s\n", scenarios[i].name);
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "--trace") == 0) {
+        return sim_recorded(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc == 4 && strcmp(argv[1], "--save") == 0) {
+        const sim_scenario_t *scenario = sim_find_scenario(argv[3]);
+
+        if (scenario == NULL) {
+            sim_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        return sim_scenario(scenario, argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* No argument runs them all */
+    if (argc == 1) {
+        for (size_t i = 0; i < SIM_SCENARIO_COUNT; i++) {
+            is_passed &= sim_scenario(&scenarios[i], NULL);
+        }
+
+        return is_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        const sim_scenario_t *scenario = sim_find_scenario(argv[i]);
+
+        if (scenario == NULL) {
+            sim_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        is_passed &= sim_scenario(scenario, NULL);
+    }
+
+    return is_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,288 @@
+#include "trace.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Traces start late enough for the edge noise to stay positive */
+#define TRACE_START_US 1000000
+
+/* Width of a glitch pulse in microseconds */
+#define TRACE_GLITCH_WIDTH_US 30
+
+/**
+ * @brief Growable arrays of a trace.
+ */
+typedef struct {
+    trace_t *trace;
+    size_t edge_capacity;
+    size_t crossing_capacity;
+} trace_builder_t;
+
+/**
+ * @brief Draws the next number of a xorshift generator.
+ *
+ * @param state State of the generator, never 0.
+ *
+ * @return Pseudo random number.
+ */
+static uint32_t trace_random(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    *state = x;
+
+    return x;
+}
+
+/**
+ * @brief Draws a uniform number between 0 and 1.
+ *
+ * @param state State of the generator.
+ *
+ * @return Number in [0, 1).
+ */
+static double trace_uniform(uint32_t *state)
+{
+    return (double)trace_random(state) / 4294967296.0;
+}
+
+/**
+ * @brief Draws the noise of an edge.
+ *
+ * @param state State of the generator.
+ * @param noise Peak noise in microseconds.
+ *
+ * @return Noise in microseconds, from -noise to noise.
+ */
+static double trace_noise(uint32_t *state, uint32_t noise)
+{
+    return (trace_uniform(state) * 2.0 - 1.0) * noise;
+}
+
+/**
+ * @brief Appends an edge to the trace.
+ *
+ * @param builder Arrays of the trace.
+ * @param time Time of the edge in microseconds.
+ * @param level Level of the input after the edge.
+ *
+ * @return void
+ */
+static void trace_push_edge(trace_builder_t *builder, double time, bool level)
+{
+    trace_t *trace = builder->trace;
+
+    if (trace->edge_count == builder->edge_capacity) {
+        builder->edge_capacity = builder->edge_capacity * 2 + 1024;
+        trace->edges = realloc(trace->edges,
+                               builder->edge_capacity * sizeof(trace_edge_t));
+    }
+
+    trace->edges[trace->edge_count++] = (trace_edge_t){
+        .time = (uint64_t)llround(time),
+        .level = level,
+    };
+}
+
+/**
+ * @brief Appends a true zero-crossing to the trace.
+ *
+ * @param builder Arrays of the trace.
+ * @param time Time of the zero-crossing in microseconds.
+ *
+ * @return void
+ */
+static void trace_push_crossing(trace_builder_t *builder, double time)
+{
+    trace_t *trace = builder->trace;
+
+    if (trace->crossing_count == builder->crossing_capacity) {
+        builder->crossing_capacity = builder->crossing_capacity * 2 + 1024;
+        trace->crossings =
+            realloc(trace->crossings,
+                    builder->crossing_capacity * sizeof(uint64_t));
+    }
+
+    trace->crossings[trace->crossing_count++] = (uint64_t)llround(time);
+}
+
+/**
+ * @brief Gets the powergrid frequency at a time of the trace.
+ *
+ * @param config Parameters of the trace.
+ * @param time Time from the start of the trace in seconds.
+ *
+ * @return Frequency in Hz.
+ */
+static double trace_frequency(const trace_config_t *config, double time)
+{
+    if (config->switch_time > 0 && time >= config->switch_time) {
+        return config->switch_frequency;
+    }
+
+    return config->frequency + config->drift * time;
+}
+
+void trace_generate(const trace_config_t *config, trace_t *trace)
+{
+    trace_builder_t builder = { .trace = trace };
+    uint32_t state = config->seed ? config->seed : 1;
+    const double end = TRACE_START_US + config->duration * 1e6;
+    const double half_width = config->pulse_width / 2.0;
+
+    *trace = (trace_t){ 0 };
+
+    if (config->switch_time > 0) {
+        trace->event_time =
+            (uint64_t)(TRACE_START_US + config->switch_time * 1e6);
+    }
+
+    if (config->outage_duration > 0) {
+        trace->event_time =
+            (uint64_t)(TRACE_START_US + config->outage_time * 1e6);
+    }
+
+    const double outage_end = config->outage_time + config->outage_duration;
+
+    double crossing = TRACE_START_US;
+    bool is_positive = true;
+    bool was_out = false;
+
+    while (crossing < end) {
+        const double time = (crossing - TRACE_START_US) / 1e6;
+        const double half = 5e5 / trace_frequency(config, time);
+        const double next = crossing + half;
+        const bool is_out = config->outage_duration > 0 &&
+                            time >= config->outage_time && time < outage_end;
+
+        /* The mains stops on a zero-crossing, which closes the last window */
+        if (!was_out) {
+            trace_push_crossing(&builder, crossing);
+        }
+
+        was_out = is_out;
+
+        if (is_out) {
+            crossing = next;
+            is_positive = !is_positive;
+            continue;
+        }
+
+        const bool is_missing = trace_uniform(&state) < config->missing_rate;
+        const bool is_glitch = trace_uniform(&state) < config->glitch_rate;
+
+        if (config->detector == TRACE_DETECTOR_PULSE) {
+            if (!is_missing) {
+                trace_push_edge(&builder,
+                                crossing - half_width +
+                                    trace_noise(&state, config->noise),
+                                true);
+                trace_push_edge(&builder,
+                                crossing + half_width +
+                                    trace_noise(&state, config->noise),
+                                false);
+            }
+
+            /* Glitch in the middle of the low time */
+            if (is_glitch) {
+                const double glitch = crossing + half / 2;
+
+                trace_push_edge(&builder, glitch, true);
+                trace_push_edge(&builder, glitch + TRACE_GLITCH_WIDTH_US,
+                                false);
+            }
+
+        } else if (is_positive) {
+            if (!is_missing) {
+                trace_push_edge(&builder,
+                                crossing + half_width +
+                                    trace_noise(&state, config->noise),
+                                true);
+                trace_push_edge(&builder,
+                                next - half_width +
+                                    trace_noise(&state, config->noise),
+                                false);
+            }
+
+            /* Glitch in the middle of the negative half-cycle */
+            if (is_glitch) {
+                const double glitch = next + half / 2;
+
+                trace_push_edge(&builder, glitch, true);
+                trace_push_edge(&builder, glitch + TRACE_GLITCH_WIDTH_US,
+                                false);
+            }
+        }
+
+        crossing = next;
+        is_positive = !is_positive;
+    }
+
+    /* Close the last window */
+    trace_push_crossing(&builder, crossing);
+}
+
+bool trace_load(const char *path, trace_t *trace)
+{
+    trace_builder_t builder = { .trace = trace };
+    char line[128];
+
+    *trace = (trace_t){ 0 };
+
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned long long time;
+        int level;
+
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+
+        if (sscanf(line, "%llu %d", &time, &level) != 2) {
+            fclose(file);
+            trace_free(trace);
+            return false;
+        }
+
+        trace_push_edge(&builder, (double)time, level != 0);
+    }
+
+    fclose(file);
+
+    return trace->edge_count > 0;
+}
+
+bool trace_save(const char *path, const trace_t *trace)
+{
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "# time_us level\n");
+
+    for (size_t i = 0; i < trace->edge_count; i++) {
+        fprintf(file, "%llu %d\n", (unsigned long long)trace->edges[i].time,
+                trace->edges[i].level ? 1 : 0);
+    }
+
+    return fclose(file) == 0;
+}
+
+void trace_free(trace_t *trace)
+{
+    free(trace->edges);
+    free(trace->crossings);
+
+    *trace = (trace_t){ 0 };
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Shape of the zero-crossing detector output.
+ */
+typedef enum {
+    /* High for a short pulse centered on every zero-crossing */
+    TRACE_DETECTOR_PULSE = 0,
+
+    /* High during the positive half-cycles, edges late by the same delay */
+    TRACE_DETECTOR_SQUARE,
+} trace_detector_t;
+
+/**
+ * @brief Parameters of a synthetic trace.
+ */
+typedef struct {
+    /* Powergrid frequency at the start in Hz */
+    double frequency;
+
+    /* Frequency drift in Hz per second */
+    double drift;
+
+    /* Time of a step to another frequency in seconds, 0 for none */
+    double switch_time;
+    double switch_frequency;
+
+    /* Time and length of a mains loss in seconds, 0 for none */
+    double outage_time;
+    double outage_duration;
+
+    /* Length of the trace in seconds */
+    double duration;
+
+    /* Pulse width, or twice the edge delay of a square detector, in us */
+    uint32_t pulse_width;
+
+    /* Peak uniform noise on every edge in microseconds */
+    uint32_t noise;
+
+    /* Probability of a glitch pulse and of a missing pulse per cycle */
+    double glitch_rate;
+    double missing_rate;
+
+    /* Seed of the pseudo random generator */
+    uint32_t seed;
+
+    trace_detector_t detector;
+} trace_config_t;
+
+/**
+ * @brief Edge of the detector output.
+ */
+typedef struct {
+    /* Time of the edge in microseconds */
+    uint64_t time;
+
+    /* Level of the input after the edge */
+    bool level;
+} trace_edge_t;
+
+/**
+ * @brief Detector edges and the true zero-crossings they come from.
+ */
+typedef struct {
+    trace_edge_t *edges;
+    size_t edge_count;
+
+    /* All the zero-crossings in microseconds, none for a recorded trace */
+    uint64_t *crossings;
+    size_t crossing_count;
+
+    /* Time of the frequency step or of the mains loss, 0 for none */
+    uint64_t event_time;
+} trace_t;
+
+/**
+ * @brief Generates a synthetic trace.
+ *
+ * @param config Parameters of the trace.
+ * @param trace Trace to fill, freed with trace_free().
+ *
+ * @return void
+ */
+void trace_generate(const trace_config_t *config, trace_t *trace);
+
+/**
+ * @brief Loads a recorded trace, one "time_us level" edge per line.
+ *
+ * Lines starting with '#' are comments.
+ *
+ * @param path Path of the trace file.
+ * @param trace Trace to fill, freed with trace_free().
+ *
+ * @return true on success.
+ */
+bool trace_load(const char *path, trace_t *trace);
+
+/**
+ * @brief Saves the edges of a trace in the format read by trace_load().
+ *
+ * @param path Path of the trace file.
+ * @param trace Trace to save.
+ *
+ * @return true on success.
+ */
+bool trace_save(const char *path, const trace_t *trace);
+
+/**
+ * @brief Frees the memory of a trace.
+ *
+ * @param trace Trace to free.
+ *
+ * @return void
+ */
+void trace_free(trace_t *trace);
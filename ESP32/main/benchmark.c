@@ -0,0 +1,266 @@
+#include "benchmark.h"
+#include <string.h>
+#include "driver/ledc.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "dimmer_state.h"
+#include "mains_tracker.h"
+#include "metrics.h"
+#include "phase_lut.h"
+#include "transition.h"
+
+/* LEDC resources generating the edges */
+#define BENCHMARK_LEDC_MODE LEDC_LOW_SPEED_MODE
+#define BENCHMARK_LEDC_TIMER LEDC_TIMER_0
+#define BENCHMARK_LEDC_CHANNEL LEDC_CHANNEL_0
+#define BENCHMARK_LEDC_RESOLUTION LEDC_TIMER_14_BIT
+
+/* Square wave, the input is high for half of the period */
+#define BENCHMARK_LEDC_DUTY (1 << (BENCHMARK_LEDC_RESOLUTION - 1))
+
+/* Time to lock on a new rate, and time measured at every rate */
+#define BENCHMARK_SETTLE_MS 2000
+#define BENCHMARK_MEASURE_MS 20000
+
+/* Largest frequency error accepted by the self-test, in millihertz */
+#define BENCHMARK_FREQUENCY_TOLERANCE_MHZ 100
+
+/* Level of the channels during the benchmark, so every window fires */
+#define BENCHMARK_LEVEL (PHASE_LUT_LEVEL_MAX / 2)
+
+/* HTTP load, one request every interval to the local server */
+#define BENCHMARK_HTTP_PORT 80
+#define BENCHMARK_HTTP_INTERVAL_MS 10
+
+/* Stack sizes of the tasks */
+#define BENCHMARK_TASK_STACK_SIZE 3072
+#define BENCHMARK_LOAD_STACK_SIZE 3072
+
+/* Build profile, to tell the runs of the debug and release builds apart */
+#if CONFIG_COMPILER_OPTIMIZATION_PERF
+#define BENCHMARK_OPTIMIZATION "-O2"
+#elif CONFIG_COMPILER_OPTIMIZATION_SIZE
+#define BENCHMARK_OPTIMIZATION "-Os"
+#elif CONFIG_COMPILER_OPTIMIZATION_NONE
+#define BENCHMARK_OPTIMIZATION "-O0"
+#else
+#define BENCHMARK_OPTIMIZATION "-Og"
+#endif
+
+#if CONFIG_DIMMER_FIRING_CHECKS
+#define BENCHMARK_FIRING_CHECKS "on"
+#else
+#define BENCHMARK_FIRING_CHECKS "off"
+#endif
+
+/* Rates of the synthetic edges, the last one is the tracker limit */
+static const uint32_t benchmark_rates[] = { 50, 60, 100, 200 };
+
+/* Tag used in the log messages */
+static const char *TAG = "BENCHMARK";
+
+/**
+ * @brief Logs the statistics of a sample.
+ *
+ * @param name Name of the sample.
+ * @param sample Sample to log.
+ * @param unit Unit of the values.
+ *
+ * @return void
+ */
+static void benchmark_log(const char *name, metrics_sample_t sample,
+                          const char *unit)
+{
+    metrics_summary_t summary;
+
+    metrics_get_summary(sample, &summary);
+
+    if (summary.count == 0) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "  %-14s n=%lu min=%ld p50=%lu p99=%lu max=%ld %s", name,
+             (unsigned long)summary.count, (long)summary.min,
+             (unsigned long)summary.p50, (unsigned long)summary.p99,
+             (long)summary.max, unit);
+}
+
+/**
+ * @brief Measures the firing path at a rate and logs the report.
+ *
+ * @param rate Rate of the edges in hertz.
+ *
+ * @return true if the self-test passed.
+ */
+static bool benchmark_run(uint32_t rate)
+{
+    esp_err_t ret;
+
+    ret = ledc_set_freq(BENCHMARK_LEDC_MODE, BENCHMARK_LEDC_TIMER, rate);
+    ESP_ERROR_CHECK(ret);
+
+    vTaskDelay(pdMS_TO_TICKS(BENCHMARK_SETTLE_MS));
+
+    metrics_reset();
+
+    vTaskDelay(pdMS_TO_TICKS(BENCHMARK_MEASURE_MS));
+
+    dimmer_edges_t edges;
+
+    dimmer_state_read_edges(&edges);
+
+    const uint32_t frequency = mains_tracker_frequency(edges.period);
+    const uint32_t expected = rate * 1000;
+    const uint32_t error = (frequency > expected) ? frequency - expected
+                                                  : expected - frequency;
+    const uint32_t missed = metrics_get_counter(METRICS_MISSED);
+    const uint32_t unlocks = metrics_get_counter(METRICS_UNLOCKS);
+    const uint32_t glitches = metrics_get_counter(METRICS_GLITCHES);
+
+    const bool is_passed = edges.is_locked &&
+                           error <= BENCHMARK_FREQUENCY_TOLERANCE_MHZ &&
+                           missed == 0 && unlocks == 0 && glitches == 0;
+
+    ESP_LOGI(TAG, "%lu Hz: measured %lu.%03lu Hz, %s", (unsigned long)rate,
+             (unsigned long)(frequency / 1000),
+             (unsigned long)(frequency % 1000),
+             edges.is_locked ? "locked" : "unlocked");
+
+    benchmark_log("isr_latency", METRICS_ISR_LATENCY, "us");
+    benchmark_log("isr_cycles", METRICS_ISR_CYCLES, "cycles");
+    benchmark_log("task_wakeup", METRICS_TASK_WAKEUP, "us");
+    benchmark_log("trigger_margin", METRICS_TRIGGER_MARGIN, "us");
+    benchmark_log("period_error", METRICS_PERIOD_ERROR, "us");
+    benchmark_log("http_handler", METRICS_HTTP_HANDLER, "us");
+
+    ESP_LOGI(TAG, "  missed=%lu skipped=%lu glitches=%lu outliers=%lu "
+             "unlocks=%lu: %s", (unsigned long)missed,
+             (unsigned long)metrics_get_counter(METRICS_SKIPPED),
+             (unsigned long)glitches,
+             (unsigned long)metrics_get_counter(METRICS_OUTLIERS),
+             (unsigned long)unlocks, is_passed ? "PASS" : "FAIL");
+
+    return is_passed;
+}
+
+/**
+ * @brief Steps through the rates, forever.
+ *
+ * @param arg Not used in this implementation.
+ */
+static void benchmark_task(void *arg)
+{
+    /* Fire every window, in the middle of the half-cycle */
+    for (size_t channel = 0; channel < CONFIG_DIMMER_CHANNEL_COUNT;
+         channel++) {
+        transition_start(channel, BENCHMARK_LEVEL, 0,
+                         TRANSITION_EASING_LINEAR);
+    }
+
+    for (uint32_t pass = 1;; pass++) {
+        size_t failures = 0;
+
+        for (size_t i = 0; i < sizeof(benchmark_rates) /
+                               sizeof(benchmark_rates[0]); i++) {
+            if (!benchmark_run(benchmark_rates[i])) {
+                failures++;
+            }
+        }
+
+        ESP_LOGI(TAG, "Pass %lu: %s", (unsigned long)pass,
+                 (failures == 0) ? "PASS" : "FAIL");
+    }
+}
+
+#if CONFIG_DIMMER_BENCHMARK_HTTP_LOAD
+/**
+ * @brief Sends brightness requests to the local HTTP server, forever.
+ *
+ * Every request opens a new connection, like the browser page does, and
+ * alternates between two levels to exercise the transition path too.
+ *
+ * @param arg Not used in this implementation.
+ */
+static void benchmark_load_task(void *arg)
+{
+    const struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCHMARK_HTTP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    char request[96];
+    char response[64];
+
+    for (uint32_t count = 0;; count++) {
+        vTaskDelay(pdMS_TO_TICKS(BENCHMARK_HTTP_INTERVAL_MS));
+
+        const int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+        if (sock < 0) {
+            continue;
+        }
+
+        /* Fails until the server is started */
+        if (connect(sock, (const struct sockaddr *)&address,
+                    sizeof(address)) == 0) {
+            const int length =
+                snprintf(request, sizeof(request),
+                         "GET /?brightness=%d HTTP/1.1\r\n"
+                         "Host: localhost\r\nConnection: close\r\n\r\n",
+                         (count % 2 == 0) ? 40 : 60);
+
+            if (send(sock, request, length, 0) == length) {
+                while (recv(sock, response, sizeof(response), 0) > 0) {
+                }
+            }
+        }
+
+        close(sock);
+    }
+}
+#endif
+
+void benchmark_init(gpio_num_t pin)
+{
+    esp_err_t ret;
+
+    const ledc_timer_config_t timer_config = {
+        .speed_mode = BENCHMARK_LEDC_MODE,
+        .duty_resolution = BENCHMARK_LEDC_RESOLUTION,
+        .timer_num = BENCHMARK_LEDC_TIMER,
+        .freq_hz = benchmark_rates[0],
+        .clk_cfg = LEDC_AUTO_CLK,
+    };
+
+    ret = ledc_timer_config(&timer_config);
+    ESP_ERROR_CHECK(ret);
+
+    const ledc_channel_config_t channel_config = {
+        .gpio_num = pin,
+        .speed_mode = BENCHMARK_LEDC_MODE,
+        .channel = BENCHMARK_LEDC_CHANNEL,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = BENCHMARK_LEDC_TIMER,
+        .duty = BENCHMARK_LEDC_DUTY,
+        .hpoint = 0,
+    };
+
+    ret = ledc_channel_config(&channel_config);
+    ESP_ERROR_CHECK(ret);
+
+    ESP_LOGW(TAG, "Synthetic edges on GPIO %d, the detector is ignored", pin);
+    ESP_LOGI(TAG, "Build %s, firing checks %s", BENCHMARK_OPTIMIZATION,
+             BENCHMARK_FIRING_CHECKS);
+
+    /* Protocol core, the measured path keeps the application core */
+    xTaskCreatePinnedToCore(benchmark_task, "benchmark",
+                            BENCHMARK_TASK_STACK_SIZE, NULL, 2, NULL, 0);
+
+#if CONFIG_DIMMER_BENCHMARK_HTTP_LOAD
+    xTaskCreatePinnedToCore(benchmark_load_task, "benchmark_load",
+                            BENCHMARK_LOAD_STACK_SIZE, NULL, 2, NULL, 0);
+#endif
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "driver/gpio.h"
+
+/**
+ * @brief Starts the benchmark of the firing path.
+ *
+ * Drives the pin with synthetic zero-crossing edges from a LEDC channel,
+ * looped back to the edge capture and to the timer synchronization inside
+ * the chip, so no detector is needed. The edges step through the mains
+ * rates and a stress rate at the limit of the period tracker, and every
+ * step logs the cycle counts, the latencies and the jitter recorded by the
+ * metrics, with a PASS or FAIL verdict. With
+ * CONFIG_DIMMER_BENCHMARK_HTTP_LOAD the HTTP server is loaded meanwhile.
+ *
+ * Must be called before the firing engine is initialized, so the loop back
+ * keeps the LEDC output.
+ *
+ * @param pin Pin driven with the edges, also the zero-crossing input.
+ *
+ * @return void
+ */
+void benchmark_init(gpio_num_t pin);
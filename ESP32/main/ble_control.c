@@ -0,0 +1,324 @@
+#include "ble_control.h"
+#include "sdkconfig.h"
+
+#if CONFIG_DIMMER_BLE
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+#include "ws_control.h"
+
+/* Name advertised to the phones */
+#define BLE_CONTROL_DEVICE_NAME "Smart Dimmer"
+
+/* Advertising interval while no phone is connected, in 0.625 ms units */
+#define BLE_CONTROL_ADV_INTERVAL BLE_GAP_ADV_ITVL_MS(500)
+
+/* Connection interval asked once connected, in 1.25 ms units */
+#define BLE_CONTROL_CONN_INTERVAL_MIN BLE_GAP_CONN_ITVL_MS(7.5)
+#define BLE_CONTROL_CONN_INTERVAL_MAX BLE_GAP_CONN_ITVL_MS(15)
+
+/* Connection events the peripheral may skip while idle */
+#define BLE_CONTROL_CONN_LATENCY 4
+
+/* Supervision timeout in 10 ms units */
+#define BLE_CONTROL_SUPERVISION_TIMEOUT 200
+
+/* ATT MTU asked for, so a state frame of every channel fits a notification
+ * after its 3 byte header, the default MTU of 23 only fits one channel */
+#define BLE_CONTROL_PREFERRED_MTU (WS_CONTROL_STATE_MAX_LENGTH + 3)
+
+/* Tag used in the log messages */
+static const char *TAG = "BLE_CONTROL";
+
+/* Service 5d1e0001-8f4a-4c35-9b3e-3a1d5c7e9f20 */
+static const ble_uuid128_t service_uuid =
+    BLE_UUID128_INIT(0x20, 0x9f, 0x7e, 0x5c, 0x1d, 0x3a, 0x3e, 0x9b, 0x35,
+                     0x4c, 0x4a, 0x8f, 0x01, 0x00, 0x1e, 0x5d);
+
+/* Brightness characteristic 5d1e0002-8f4a-4c35-9b3e-3a1d5c7e9f20 */
+static const ble_uuid128_t brightness_uuid =
+    BLE_UUID128_INIT(0x20, 0x9f, 0x7e, 0x5c, 0x1d, 0x3a, 0x3e, 0x9b, 0x35,
+                     0x4c, 0x4a, 0x8f, 0x02, 0x00, 0x1e, 0x5d);
+
+/* Attribute handle of the brightness value, set on registration */
+static uint16_t brightness_handle;
+
+/* Address type used to advertise */
+static uint8_t own_addr_type;
+
+/* Flag set once the host is synced with the controller */
+static atomic_bool is_synced = false;
+
+static void ble_control_advertise(void);
+
+/**
+ * @brief Accesses the brightness characteristic, runs on the host task.
+ *
+ * @param conn_handle Connection of the access.
+ * @param attr_handle Attribute accessed.
+ * @param ctxt Access context.
+ * @param arg Not used in this implementation.
+ *
+ * @return 0 on success, an ATT error code otherwise.
+ */
+static int ble_control_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR: {
+        uint8_t payload[WS_CONTROL_STATE_MAX_LENGTH];
+        uint32_t frequency;
+
+        const size_t length = ws_control_build_state(payload, &frequency);
+
+        return (os_mbuf_append(ctxt->om, payload, length) == 0)
+                   ? 0
+                   : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+        uint8_t payload[WS_CONTROL_FRAME_MAX_LENGTH];
+        uint16_t length;
+
+        if (OS_MBUF_PKTLEN(ctxt->om) < WS_CONTROL_FRAME_MIN_LENGTH ||
+            OS_MBUF_PKTLEN(ctxt->om) > WS_CONTROL_FRAME_MAX_LENGTH) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+
+        if (ble_hs_mbuf_to_flat(ctxt->om, payload, sizeof(payload),
+                                &length) != 0) {
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+
+        ws_control_apply_frame(payload, length);
+        ws_control_notify();
+
+        return 0;
+    }
+
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+/* GATT services of the dimmer */
+static const struct ble_gatt_svc_def services[] = {
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &service_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            {
+                .uuid = &brightness_uuid.u,
+                .access_cb = ble_control_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
+                         BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &brightness_handle,
+            },
+            { 0 },
+        },
+    },
+    { 0 },
+};
+
+/**
+ * @brief Handles the GAP events, runs on the host task.
+ *
+ * @param event GAP event.
+ * @param arg Not used in this implementation.
+ *
+ * @return 0, the events are always accepted.
+ */
+static int ble_control_gap_event(struct ble_gap_event *event, void *arg)
+{
+    switch (event->type) {
+    case BLE_GAP_EVENT_CONNECT:
+        if (event->connect.status != 0) {
+            ble_control_advertise();
+            break;
+        }
+
+        /* Short interval for low latency, with latency to idle between */
+        const struct ble_gap_upd_params params = {
+            .itvl_min = BLE_CONTROL_CONN_INTERVAL_MIN,
+            .itvl_max = BLE_CONTROL_CONN_INTERVAL_MAX,
+            .latency = BLE_CONTROL_CONN_LATENCY,
+            .supervision_timeout = BLE_CONTROL_SUPERVISION_TIMEOUT,
+        };
+
+        ble_gap_update_params(event->connect.conn_handle, &params);
+
+        /* Notifications are cut to the MTU, phones rarely ask for more */
+        ble_gattc_exchange_mtu(event->connect.conn_handle, NULL, NULL);
+
+        /* Keep advertising while there are free connections */
+        ble_control_advertise();
+        break;
+
+    case BLE_GAP_EVENT_DISCONNECT:
+    case BLE_GAP_EVENT_ADV_COMPLETE:
+        ble_control_advertise();
+        break;
+
+    case BLE_GAP_EVENT_MTU:
+        ESP_LOGI(TAG, "MTU %u", event->mtu.value);
+
+        /* Frames notified before the exchange may have been cut */
+        ws_control_notify();
+        break;
+
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        /* New subscriber, send it the state on the next check */
+        if (event->subscribe.attr_handle == brightness_handle &&
+            event->subscribe.cur_notify) {
+            ws_control_notify();
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Starts advertising the control service.
+ *
+ * @return void
+ */
+static void ble_control_advertise(void)
+{
+    if (ble_gap_adv_active()) {
+        return;
+    }
+
+    struct ble_hs_adv_fields fields = {
+        .flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP,
+        .uuids128 = (ble_uuid128_t *)&service_uuid,
+        .num_uuids128 = 1,
+        .uuids128_is_complete = 1,
+    };
+
+    struct ble_hs_adv_fields response_fields = {
+        .name = (uint8_t *)BLE_CONTROL_DEVICE_NAME,
+        .name_len = sizeof(BLE_CONTROL_DEVICE_NAME) - 1,
+        .name_is_complete = 1,
+    };
+
+    if (ble_gap_adv_set_fields(&fields) != 0 ||
+        ble_gap_adv_rsp_set_fields(&response_fields) != 0) {
+        ESP_LOGE(TAG, "Failed to set the advertising data");
+        return;
+    }
+
+    const struct ble_gap_adv_params params = {
+        .conn_mode = BLE_GAP_CONN_MODE_UND,
+        .disc_mode = BLE_GAP_DISC_MODE_GEN,
+        .itvl_min = BLE_CONTROL_ADV_INTERVAL,
+        .itvl_max = BLE_CONTROL_ADV_INTERVAL,
+    };
+
+    /* Fails while all the connections are in use, a disconnect retries */
+    ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &params,
+                      ble_control_gap_event, NULL);
+}
+
+/**
+ * @brief Callback of the host once synced with the controller.
+ *
+ * @return void
+ */
+static void ble_control_on_sync(void)
+{
+    if (ble_hs_id_infer_auto(0, &own_addr_type) != 0) {
+        ESP_LOGE(TAG, "Failed to infer the address type");
+        return;
+    }
+
+    atomic_store(&is_synced, true);
+
+    ble_control_advertise();
+}
+
+/**
+ * @brief Callback of the host when it resets.
+ *
+ * @param reason Reset reason.
+ *
+ * @return void
+ */
+static void ble_control_on_reset(int reason)
+{
+    atomic_store(&is_synced, false);
+
+    ESP_LOGW(TAG, "Host reset, reason %d", reason);
+}
+
+/**
+ * @brief Runs the NimBLE host.
+ *
+ * @param arg Not used in this implementation.
+ */
+static void ble_control_host_task(void *arg)
+{
+    /* Returns only when the host is stopped */
+    nimble_port_run();
+
+    nimble_port_freertos_deinit();
+}
+
+void ble_control_init(void)
+{
+    esp_err_t ret;
+
+    ret = nimble_port_init();
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start NimBLE");
+        return;
+    }
+
+    ble_hs_cfg.sync_cb = ble_control_on_sync;
+    ble_hs_cfg.reset_cb = ble_control_on_reset;
+
+    ble_svc_gap_init();
+    ble_svc_gatt_init();
+
+    if (ble_gatts_count_cfg(services) != 0 ||
+        ble_gatts_add_svcs(services) != 0) {
+        ESP_LOGE(TAG, "Failed to register the GATT services");
+        return;
+    }
+
+    ble_svc_gap_device_name_set(BLE_CONTROL_DEVICE_NAME);
+
+    if (ble_att_set_preferred_mtu(BLE_CONTROL_PREFERRED_MTU) != 0) {
+        ESP_LOGE(TAG, "Failed to set the preferred MTU");
+    }
+
+    nimble_port_freertos_init(ble_control_host_task);
+}
+
+void ble_control_notify(void)
+{
+    /* Subscribed peers read the value through the access callback */
+    if (atomic_load(&is_synced)) {
+        ble_gatts_chr_updated(brightness_handle);
+    }
+}
+
+#else
+
+void ble_control_init(void)
+{
+}
+
+void ble_control_notify(void)
+{
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+/**
+ * @brief Starts the BLE GATT control service.
+ *
+ * The service has a single brightness characteristic. Writes, with or
+ * without response, take the control frame of the WebSocket channel, and
+ * reads and notifications return its state frame. The dimmer advertises
+ * with a slow interval while no phone is connected, and asks for a short
+ * connection interval once one connects, so the radio idles at low power
+ * and commands still land within a few milliseconds. It also starts an MTU
+ * exchange, as the default MTU cuts the state frames of two or more
+ * channels in the notifications, and notifies the state again once done.
+ *
+ * Only available with CONFIG_DIMMER_BLE, otherwise it does nothing.
+ *
+ * @return void
+ */
+void ble_control_init(void);
+
+/**
+ * @brief Notifies the subscribed phones that the state changed.
+ *
+ * Safe to call from any task. Called at the rate of the state pushes, so
+ * the notifications are coalesced and rate-limited the same way.
+ *
+ * @return void
+ */
+void ble_control_notify(void);
@@ -0,0 +1,92 @@
+#include "dimmer_state.h"
+#include <stdatomic.h>
+#include "esp_attr.h"
+
+/* Sequence counter of the edge snapshot, odd while an update is running */
+static atomic_uint edges_sequence = 0;
+
+/* Edge snapshot protected by the sequence counter */
+static volatile dimmer_edges_t edges_data;
+
+/* Single word fields, read and written atomically */
+static atomic_uint zero_crossing_offset = 0;
+
+/* Single word fields of every channel, read and written atomically */
+static atomic_uint levels[FIRING_MAX_CHANNELS];
+static atomic_uint trigger_delays[FIRING_MAX_CHANNELS];
+
+void IRAM_ATTR dimmer_state_write_edges(const dimmer_edges_t *edges)
+{
+    const unsigned int sequence =
+        atomic_load_explicit(&edges_sequence, memory_order_relaxed);
+
+    /* Mark the snapshot as being updated before touching the data */
+    atomic_store_explicit(&edges_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    edges_data.rising_time = edges->rising_time;
+    edges_data.falling_time = edges->falling_time;
+    edges_data.period = edges->period;
+    edges_data.is_crossing_zero = edges->is_crossing_zero;
+    edges_data.is_locked = edges->is_locked;
+    edges_data.is_timed_out = edges->is_timed_out;
+    edges_data.is_mains_lost = edges->is_mains_lost;
+
+    /* Publish the snapshot */
+    atomic_store_explicit(&edges_sequence, sequence + 2, memory_order_release);
+}
+
+void IRAM_ATTR dimmer_state_read_edges(dimmer_edges_t *edges)
+{
+    unsigned int sequence;
+
+    do {
+        sequence = atomic_load_explicit(&edges_sequence, memory_order_acquire);
+
+        edges->rising_time = edges_data.rising_time;
+        edges->falling_time = edges_data.falling_time;
+        edges->period = edges_data.period;
+        edges->is_crossing_zero = edges_data.is_crossing_zero;
+        edges->is_locked = edges_data.is_locked;
+        edges->is_timed_out = edges_data.is_timed_out;
+        edges->is_mains_lost = edges_data.is_mains_lost;
+
+        atomic_thread_fence(memory_order_acquire);
+
+    /* Retry if the writer was active or published during the copy */
+    } while ((sequence & 1) ||
+             sequence != atomic_load_explicit(&edges_sequence,
+                                              memory_order_relaxed));
+}
+
+void IRAM_ATTR dimmer_state_set_level(size_t channel, uint16_t value)
+{
+    atomic_store_explicit(&levels[channel], value, memory_order_relaxed);
+}
+
+uint16_t IRAM_ATTR dimmer_state_get_level(size_t channel)
+{
+    return atomic_load_explicit(&levels[channel], memory_order_relaxed);
+}
+
+void IRAM_ATTR dimmer_state_set_zero_crossing(uint32_t offset)
+{
+    atomic_store_explicit(&zero_crossing_offset, offset, memory_order_relaxed);
+}
+
+uint32_t IRAM_ATTR dimmer_state_get_zero_crossing(void)
+{
+    return atomic_load_explicit(&zero_crossing_offset, memory_order_relaxed);
+}
+
+void IRAM_ATTR dimmer_state_set_trigger(size_t channel, uint32_t delay)
+{
+    atomic_store_explicit(&trigger_delays[channel], delay,
+                          memory_order_relaxed);
+}
+
+uint32_t IRAM_ATTR dimmer_state_get_trigger(size_t channel)
+{
+    return atomic_load_explicit(&trigger_delays[channel],
+                                memory_order_relaxed);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "firing.h"
+#include "phase_lut.h"
+
+/**
+ * @brief Snapshot of the zero-crossing edges captured by the ISR.
+ *
+ * The snapshot is published through a sequence lock. The ISR is the only
+ * writer, and readers on any core get a consistent copy without tearing the
+ * 64-bit timestamps.
+ */
+typedef struct {
+    /* Timestamp of the last rising edge in microseconds */
+    uint64_t rising_time;
+
+    /* Timestamp of the last falling edge in microseconds */
+    uint64_t falling_time;
+
+    /* Filtered powergrid sine period in microseconds */
+    uint32_t period;
+
+    /* Level of the zero-crossing input after the last edge */
+    bool is_crossing_zero;
+
+    /* Flag set while the period tracker is locked to the powergrid */
+    bool is_locked;
+
+    /* Flag set from a watchdog timeout until the next genuine rising edge */
+    bool is_timed_out;
+
+    /* Flag set from a mains loss until the period tracker locks again */
+    bool is_mains_lost;
+} dimmer_edges_t;
+
+/**
+ * @brief Publishes a new edge snapshot.
+ *
+ * Must only be called by the single writer, the zero-crossing ISR. Runs in
+ * constant time and never blocks.
+ *
+ * @param edges Snapshot to publish.
+ *
+ * @return void
+ */
+void dimmer_state_write_edges(const dimmer_edges_t *edges);
+
+/**
+ * @brief Reads a consistent copy of the edge snapshot.
+ *
+ * Retries while the writer is in the middle of an update, which only
+ * happens when the read overlaps an edge interrupt.
+ *
+ * @param edges Destination of the snapshot.
+ *
+ * @return void
+ */
+void dimmer_state_read_edges(dimmer_edges_t *edges);
+
+/**
+ * @brief Sets the brightness level of a channel.
+ *
+ * @param channel Index of the channel, below FIRING_MAX_CHANNELS.
+ * @param value Brightness level from 0 to PHASE_LUT_LEVEL_MAX.
+ *
+ * @return void
+ */
+void dimmer_state_set_level(size_t channel, uint16_t value);
+
+/**
+ * @brief Gets the brightness level of a channel.
+ *
+ * @param channel Index of the channel, below FIRING_MAX_CHANNELS.
+ *
+ * @return Brightness level from 0 to PHASE_LUT_LEVEL_MAX.
+ */
+uint16_t dimmer_state_get_level(size_t channel);
+
+/**
+ * @brief Sets the zero-crossing offset from the rising edge.
+ *
+ * @param offset Offset in microseconds.
+ *
+ * @return void
+ */
+void dimmer_state_set_zero_crossing(uint32_t offset);
+
+/**
+ * @brief Gets the zero-crossing offset from the rising edge.
+ *
+ * @return Offset in microseconds.
+ */
+uint32_t dimmer_state_get_zero_crossing(void);
+
+/**
+ * @brief Sets the trigger delay of a channel from the rising edge.
+ *
+ * @param channel Index of the channel, below FIRING_MAX_CHANNELS.
+ * @param delay Delay in microseconds.
+ *
+ * @return void
+ */
+void dimmer_state_set_trigger(size_t channel, uint32_t delay);
+
+/**
+ * @brief Gets the trigger delay of a channel from the rising edge.
+ *
+ * @param channel Index of the channel, below FIRING_MAX_CHANNELS.
+ *
+ * @return Delay in microseconds.
+ */
+uint32_t dimmer_state_get_trigger(size_t channel);
@@ -0,0 +1,130 @@
+#include "edge_capture.h"
+#include "driver/mcpwm_prelude.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "power_profile.h"
+
+/* MCPWM capture handles */
+static mcpwm_cap_timer_handle_t capture_timer;
+static mcpwm_cap_channel_handle_t capture_channel;
+
+/* Function called on every edge */
+static edge_capture_callback_t edge_callback;
+
+/* Capture clock ticks per microsecond */
+static uint32_t ticks_per_us;
+
+/* Microsecond timeline extended from the 32-bit capture counter */
+static uint64_t capture_time = 0;
+static uint32_t last_capture = 0;
+static uint32_t capture_remainder = 0;
+
+/**
+ * @brief Callback of the capture channel, runs in the ISR.
+ *
+ * Converts the captured counter value to the microsecond timeline, carrying
+ * the remainder of the division so the timeline never drifts. The counter
+ * wraps every 2^32 ticks, 53.7 s at 80 MHz, so a longer gap between two
+ * edges, such as a mains outage, hides whole wraps from the difference.
+ * They are counted from the system time, read a few microseconds after the
+ * edge, which keeps the timeline on the one of esp_timer_get_time().
+ *
+ * @param channel Capture channel that latched the edge.
+ * @param edata Captured counter value and edge.
+ * @param user_data Not used in this implementation.
+ *
+ * @return true if a higher priority task was woken up.
+ */
+static bool IRAM_ATTR edge_capture_isr(mcpwm_cap_channel_handle_t channel,
+                                       const mcpwm_capture_event_data_t *edata,
+                                       void *user_data)
+{
+    /* Counter differences stay valid across one 32-bit wrap around */
+    const uint32_t ticks =
+        (edata->cap_value - last_capture) + capture_remainder;
+
+    last_capture = edata->cap_value;
+
+    /* Ticks since the last edge by the system time, past the edge by the
+     * interrupt latency, far below one wrap */
+    const int64_t now = esp_timer_get_time();
+    const uint64_t elapsed =
+        (now > (int64_t)capture_time)
+            ? (uint64_t)(now - (int64_t)capture_time) * ticks_per_us
+            : 0;
+    const uint64_t wraps = (elapsed > ticks) ? (elapsed - ticks) >> 32 : 0;
+
+    if (wraps == 0) {
+        capture_time += ticks / ticks_per_us;
+        capture_remainder = ticks % ticks_per_us;
+    } else {
+        const uint64_t total = (wraps << 32) + ticks;
+
+        capture_time += total / ticks_per_us;
+        capture_remainder = total % ticks_per_us;
+    }
+
+    return edge_callback(capture_time, edata->cap_edge == MCPWM_CAP_EDGE_POS);
+}
+
+void edge_capture_init(gpio_num_t pin, edge_capture_callback_t callback)
+{
+    esp_err_t ret;
+
+    edge_callback = callback;
+
+    const mcpwm_capture_timer_config_t timer_config = {
+        .group_id = 0,
+        .clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+    };
+
+    ret = mcpwm_new_capture_timer(&timer_config, &capture_timer);
+    ESP_ERROR_CHECK(ret);
+
+    uint32_t resolution;
+
+    ret = mcpwm_capture_timer_get_resolution(capture_timer, &resolution);
+    ESP_ERROR_CHECK(ret);
+
+    ticks_per_us = resolution / 1000000;
+
+    /* Latch both edges, the input already has an external pull-up */
+    const mcpwm_capture_channel_config_t channel_config = {
+        .gpio_num = pin,
+        .intr_priority = power_profile_intr_priority(),
+        .prescale = 1,
+        .flags.pos_edge = true,
+        .flags.neg_edge = true,
+#if CONFIG_DIMMER_BENCHMARK
+        /* The benchmark drives the synthetic edges from this chip */
+        .flags.io_loop_back = true,
+#endif
+    };
+
+    ret = mcpwm_new_capture_channel(capture_timer, &channel_config,
+                                    &capture_channel);
+    ESP_ERROR_CHECK(ret);
+
+    const mcpwm_capture_event_callbacks_t callbacks = {
+        .on_cap = edge_capture_isr,
+    };
+
+    ret = mcpwm_capture_channel_register_event_callbacks(capture_channel,
+                                                         &callbacks, NULL);
+    ESP_ERROR_CHECK(ret);
+
+    ret = mcpwm_capture_channel_enable(capture_channel);
+    ESP_ERROR_CHECK(ret);
+
+    ret = mcpwm_capture_timer_enable(capture_timer);
+    ESP_ERROR_CHECK(ret);
+
+    /* Start the timeline at the system time, the counter starts at 0 */
+    capture_time = esp_timer_get_time();
+    last_capture = 0;
+    capture_remainder = 0;
+
+    ret = mcpwm_capture_timer_start(capture_timer);
+    ESP_ERROR_CHECK(ret);
+}
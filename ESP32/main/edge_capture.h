@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+
+/**
+ * @brief Callback called from the capture ISR on every zero-crossing edge.
+ *
+ * @param time Timestamp of the edge in microseconds, latched by hardware.
+ * @param is_rising true for a rising edge, false for a falling edge.
+ *
+ * @return true if a higher priority task was woken up.
+ */
+typedef bool (*edge_capture_callback_t)(uint64_t time, bool is_rising);
+
+/**
+ * @brief Initializes the hardware capture of the zero-crossing edges.
+ *
+ * Both edges of the input are latched by an MCPWM capture channel, so the
+ * timestamps are exact to the capture clock tick regardless of the interrupt
+ * latency. The capture ISR is allocated on the calling core, at the level of
+ * the boot power profile.
+ *
+ * @param pin Zero-crossing input pin.
+ * @param callback Function called on every edge, from the ISR.
+ *
+ * @return void
+ */
+void edge_capture_init(gpio_num_t pin, edge_capture_callback_t callback);
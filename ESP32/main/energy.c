@@ -0,0 +1,138 @@
+#include "energy.h"
+#include <stdatomic.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "dimmer_state.h"
+#include "phase_lut.h"
+#include "sdkconfig.h"
+
+/* Number of channels accounted */
+#define ENERGY_CHANNEL_COUNT CONFIG_DIMMER_CHANNEL_COUNT
+
+/* Interval between the power estimates in microseconds */
+#define ENERGY_INTERVAL_US 100000
+
+/* Milliwatts times microseconds in a millijoule */
+#define ENERGY_MW_US_PER_MJ 1000000
+
+/* Rated power of every channel in watts */
+static atomic_ushort rated_watts[ENERGY_CHANNEL_COUNT] = {
+    [0 ... ENERGY_CHANNEL_COUNT - 1] = CONFIG_DIMMER_ENERGY_RATED_W,
+};
+
+/* Last power estimate in milliwatts, and the energy in millijoules */
+static atomic_uint powers[ENERGY_CHANNEL_COUNT];
+static atomic_ullong energies[ENERGY_CHANNEL_COUNT];
+
+/* Part of a millijoule left over by the last integration */
+static uint32_t remainders[ENERGY_CHANNEL_COUNT];
+
+/* Time of the last integration in microseconds */
+static int64_t last_time = 0;
+
+/* Timer estimating the power */
+static esp_timer_handle_t energy_timer;
+
+/**
+ * @brief Estimates the power of every channel and integrates it, runs on
+ * the timer task.
+ *
+ * The power of the interval just ended is taken as the one at its end,
+ * carrying the remainder of the division so the energy never drifts.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void energy_update(void *arg)
+{
+    const int64_t now = esp_timer_get_time();
+    const uint64_t elapsed = (uint64_t)(now - last_time);
+
+    last_time = now;
+
+    dimmer_edges_t edges;
+
+    dimmer_state_read_edges(&edges);
+
+    /* Nothing is fired without the lock or after the edges stopped */
+    const bool is_firing =
+        edges.is_locked && !edges.is_mains_lost && !edges.is_timed_out;
+
+    for (size_t channel = 0; channel < ENERGY_CHANNEL_COUNT; channel++) {
+        const uint32_t rated =
+            (uint32_t)atomic_load_explicit(&rated_watts[channel],
+                                           memory_order_relaxed) *
+            1000;
+        const uint32_t power =
+            is_firing ? phase_lut_power(channel,
+                                        dimmer_state_get_level(channel), rated)
+                      : 0;
+        const uint64_t work = (uint64_t)power * elapsed + remainders[channel];
+
+        remainders[channel] = work % ENERGY_MW_US_PER_MJ;
+
+        atomic_store_explicit(&powers[channel], power, memory_order_relaxed);
+        atomic_fetch_add_explicit(&energies[channel],
+                                  work / ENERGY_MW_US_PER_MJ,
+                                  memory_order_relaxed);
+    }
+}
+
+void energy_init(void)
+{
+    esp_err_t ret;
+
+    last_time = esp_timer_get_time();
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = energy_update,
+        .name = "energy",
+    };
+
+    ret = esp_timer_create(&timer_args, &energy_timer);
+    ESP_ERROR_CHECK(ret);
+
+    ret = esp_timer_start_periodic(energy_timer, ENERGY_INTERVAL_US);
+    ESP_ERROR_CHECK(ret);
+}
+
+void energy_set_rated(size_t channel, uint16_t watts)
+{
+    if (channel >= ENERGY_CHANNEL_COUNT) {
+        return;
+    }
+
+    if (watts > ENERGY_MAX_RATED_W) {
+        watts = ENERGY_MAX_RATED_W;
+    }
+
+    atomic_store_explicit(&rated_watts[channel], watts, memory_order_relaxed);
+}
+
+uint16_t energy_get_rated(size_t channel)
+{
+    if (channel >= ENERGY_CHANNEL_COUNT) {
+        return 0;
+    }
+
+    return atomic_load_explicit(&rated_watts[channel], memory_order_relaxed);
+}
+
+uint32_t energy_get_power(size_t channel)
+{
+    if (channel >= ENERGY_CHANNEL_COUNT) {
+        return 0;
+    }
+
+    return atomic_load_explicit(&powers[channel], memory_order_relaxed);
+}
+
+uint64_t energy_get_energy(size_t channel)
+{
+    if (channel >= ENERGY_CHANNEL_COUNT) {
+        return 0;
+    }
+
+    return atomic_load_explicit(&energies[channel], memory_order_relaxed);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Highest rated power of a channel in watts */
+#define ENERGY_MAX_RATED_W 4000
+
+/**
+ * @brief Starts the energy accounting of all the channels.
+ *
+ * A timer on the protocol core estimates the power of every channel from
+ * its level, its brightness curve and conduction window and its rated
+ * power every 100 ms, and integrates it into the energy since boot. The
+ * power is zero while the period tracker is unlocked or the mains is lost,
+ * as nothing is fired. Integer math only, nothing runs in the firing path.
+ *
+ * @return void
+ */
+void energy_init(void);
+
+/**
+ * @brief Sets the rated power of a channel.
+ *
+ * The power drawn by the load at full conduction. Can be called before
+ * energy_init(), by the saved settings.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ * @param watts Rated power in watts, up to ENERGY_MAX_RATED_W.
+ *
+ * @return void
+ */
+void energy_set_rated(size_t channel, uint16_t watts);
+
+/**
+ * @brief Gets the rated power of a channel.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ *
+ * @return Rated power in watts, CONFIG_DIMMER_ENERGY_RATED_W by default.
+ */
+uint16_t energy_get_rated(size_t channel);
+
+/**
+ * @brief Gets the estimated power of a channel.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ *
+ * @return Power over the last 100 ms in milliwatts.
+ */
+uint32_t energy_get_power(size_t channel);
+
+/**
+ * @brief Gets the estimated energy delivered by a channel.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ *
+ * @return Energy since boot in millijoules.
+ */
+uint64_t energy_get_energy(size_t channel);
@@ -0,0 +1,312 @@
+#include "espnow_group.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "firing.h"
+#include "phase_lut.h"
+#include "transition.h"
+#include "ws_control.h"
+
+/* Senders whose sequence numbers are tracked at the same time */
+#define ESPNOW_GROUP_MAX_SENDERS 4
+
+/* Time after the last accepted command of a sender before it is forgotten,
+ * so a rebooted sender counting from a low sequence number gets through */
+#define ESPNOW_GROUP_SENDER_TIMEOUT_US 10000000
+
+/* Longest group command, with an operation on every channel */
+#define ESPNOW_GROUP_MAX_LENGTH \
+    (ESPNOW_GROUP_HEADER_LENGTH + \
+     FIRING_MAX_CHANNELS * ESPNOW_GROUP_OPERATION_LENGTH)
+
+/* Commands waiting to be applied, and the task applying them */
+#define ESPNOW_GROUP_QUEUE_LENGTH 4
+#define ESPNOW_GROUP_TASK_STACK_SIZE 3072
+
+/* Tag used in the log messages */
+static const char *TAG = "ESPNOW_GROUP";
+
+/**
+ * @brief Last accepted sequence number of a sender.
+ */
+typedef struct {
+    uint8_t address[ESP_NOW_ETH_ALEN];
+    uint32_t sequence;
+    uint32_t last_used;
+    uint64_t accepted_time;
+    bool is_used;
+} espnow_group_sender_t;
+
+/**
+ * @brief Group command handed from the Wi-Fi task to the applying task.
+ */
+typedef struct {
+    /* Time of the reception in microseconds */
+    uint64_t received_time;
+
+    uint8_t address[ESP_NOW_ETH_ALEN];
+    uint8_t data[ESPNOW_GROUP_MAX_LENGTH];
+} espnow_group_frame_t;
+
+static espnow_group_sender_t senders[ESPNOW_GROUP_MAX_SENDERS];
+
+/* Commands received and not applied yet */
+static QueueHandle_t frame_queue;
+
+/* Counter ordering the use of the senders, to replace the oldest one */
+static uint32_t use_counter = 0;
+
+/**
+ * @brief Reads a little endian 16-bit field.
+ *
+ * @param data First byte of the field.
+ *
+ * @return Field value.
+ */
+static uint16_t espnow_group_read_u16(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+/**
+ * @brief Reads a little endian 32-bit field.
+ *
+ * @param data First byte of the field.
+ *
+ * @return Field value.
+ */
+static uint32_t espnow_group_read_u32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+           ((uint32_t)data[3] << 24);
+}
+
+/**
+ * @brief Checks the sequence number of a command against its sender.
+ *
+ * Sequence numbers are compared with serial number arithmetic, so they may
+ * wrap around. A sender not seen yet takes the slot of the oldest one. Any
+ * sequence number is accepted from a sender without an accepted command for
+ * ESPNOW_GROUP_SENDER_TIMEOUT_US, which resynchronizes a rebooted one.
+ *
+ * @param address MAC address of the sender.
+ * @param sequence Sequence number of the command.
+ * @param now Time of the reception in microseconds.
+ *
+ * @return true if the command is newer than the last one of the sender.
+ */
+static bool espnow_group_is_newer(const uint8_t *address, uint32_t sequence,
+                                  uint64_t now)
+{
+    espnow_group_sender_t *oldest = &senders[0];
+
+    use_counter++;
+
+    for (int i = 0; i < ESPNOW_GROUP_MAX_SENDERS; i++) {
+        espnow_group_sender_t *sender = &senders[i];
+
+        if (sender->is_used &&
+            memcmp(sender->address, address, ESP_NOW_ETH_ALEN) == 0) {
+
+            if ((int32_t)(sequence - sender->sequence) <= 0 &&
+                now - sender->accepted_time < ESPNOW_GROUP_SENDER_TIMEOUT_US) {
+                return false;
+            }
+
+            sender->sequence = sequence;
+            sender->last_used = use_counter;
+            sender->accepted_time = now;
+            return true;
+        }
+
+        if (!sender->is_used ||
+            (oldest->is_used && sender->last_used < oldest->last_used)) {
+            oldest = sender;
+        }
+    }
+
+    memcpy(oldest->address, address, ESP_NOW_ETH_ALEN);
+    oldest->sequence = sequence;
+    oldest->last_used = use_counter;
+    oldest->accepted_time = now;
+    oldest->is_used = true;
+
+    return true;
+}
+
+/**
+ * @brief Applies a group command, runs on the ESP-NOW group task.
+ *
+ * @param frame Command checked by the reception callback.
+ *
+ * @return void
+ */
+static void espnow_group_apply(const espnow_group_frame_t *frame)
+{
+    const uint8_t *data = frame->data;
+
+    if (!espnow_group_is_newer(
+            frame->address,
+            espnow_group_read_u32(&data[ESPNOW_GROUP_PACKET_SEQUENCE]),
+            frame->received_time)) {
+        return;
+    }
+
+    const size_t operations = data[ESPNOW_GROUP_PACKET_COUNT];
+    const size_t channel_count = firing_channel_count();
+    transition_request_t batch[FIRING_MAX_CHANNELS];
+    size_t count = 0;
+
+    for (size_t i = 0; i < operations; i++) {
+        const uint8_t *operation = &data[ESPNOW_GROUP_HEADER_LENGTH +
+                                         i * ESPNOW_GROUP_OPERATION_LENGTH];
+        const size_t channel = operation[ESPNOW_GROUP_OPERATION_CHANNEL];
+
+        uint16_t level =
+            espnow_group_read_u16(&operation[ESPNOW_GROUP_OPERATION_LEVEL]);
+
+        if (level > PHASE_LUT_LEVEL_MAX) {
+            level = PHASE_LUT_LEVEL_MAX;
+        }
+
+        const transition_request_t request = {
+            .target = level,
+            .duration =
+                espnow_group_read_u16(&operation[ESPNOW_GROUP_OPERATION_FADE]),
+            .easing = (transition_easing_t)
+                operation[ESPNOW_GROUP_OPERATION_EASING],
+        };
+
+        /* Expand a command to all the channels */
+        if (channel == ESPNOW_GROUP_CHANNEL_ALL) {
+            for (count = 0; count < channel_count; count++) {
+                batch[count] = request;
+                batch[count].channel = count;
+            }
+            break;
+        }
+
+        /* Channels this dimmer does not have are ignored */
+        if (channel < channel_count) {
+            batch[count] = request;
+            batch[count].channel = channel;
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    const uint32_t delay =
+        espnow_group_read_u16(&data[ESPNOW_GROUP_PACKET_DELAY]);
+
+    transition_start_batch(batch, count,
+                           frame->received_time + delay * 1000ULL);
+
+    ws_control_notify();
+}
+
+/**
+ * @brief Applies the received group commands, off the Wi-Fi task.
+ *
+ * Starting a batch may wait for another writer of the transitions, which
+ * must never stall the Wi-Fi task.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void espnow_group_task(void *arg)
+{
+    espnow_group_frame_t frame;
+
+    /* Infinity loop */
+    for (;;) {
+        if (xQueueReceive(frame_queue, &frame, portMAX_DELAY) == pdTRUE) {
+            espnow_group_apply(&frame);
+        }
+    }
+}
+
+/**
+ * @brief Callback of the received ESP-NOW frames, runs on the Wi-Fi task.
+ *
+ * Only checks the frame and queues it, the time of the reception is the
+ * one the command is scheduled from.
+ *
+ * @param info Sender and reception information.
+ * @param data Frame payload.
+ * @param length Frame length in bytes.
+ *
+ * @return void
+ */
+static void espnow_group_receive(const esp_now_recv_info_t *info,
+                                 const uint8_t *data, int length)
+{
+    /* Shared time reference, as close to the reception as possible */
+    const uint64_t received_time = esp_timer_get_time();
+
+    if (length < ESPNOW_GROUP_HEADER_LENGTH ||
+        espnow_group_read_u16(&data[ESPNOW_GROUP_PACKET_MAGIC]) !=
+            ESPNOW_GROUP_MAGIC) {
+        return;
+    }
+
+    /* Not addressed to the groups of this dimmer */
+    if (!(espnow_group_read_u32(&data[ESPNOW_GROUP_PACKET_GROUPS]) &
+          CONFIG_DIMMER_ESPNOW_GROUPS)) {
+        return;
+    }
+
+    const size_t operations = data[ESPNOW_GROUP_PACKET_COUNT];
+    const size_t used_length = ESPNOW_GROUP_HEADER_LENGTH +
+                               operations * ESPNOW_GROUP_OPERATION_LENGTH;
+
+    if (operations > FIRING_MAX_CHANNELS || (size_t)length < used_length) {
+        ESP_LOGW(TAG, "Dropped malformed command");
+        return;
+    }
+
+    espnow_group_frame_t frame = {
+        .received_time = received_time,
+    };
+
+    memcpy(frame.address, info->src_addr, ESP_NOW_ETH_ALEN);
+    memcpy(frame.data, data, used_length);
+
+    if (xQueueSend(frame_queue, &frame, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Dropped command, queue full");
+    }
+}
+
+void espnow_group_init(void)
+{
+    esp_err_t ret;
+
+    frame_queue = xQueueCreate(ESPNOW_GROUP_QUEUE_LENGTH,
+                               sizeof(espnow_group_frame_t));
+
+    if (frame_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create the command queue");
+        return;
+    }
+
+    /* Network core, next to the Wi-Fi task handing it the commands */
+    xTaskCreatePinnedToCore(espnow_group_task, "espnow_group",
+                            ESPNOW_GROUP_TASK_STACK_SIZE, NULL, 5, NULL, 0);
+
+    ret = esp_now_init();
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start ESP-NOW");
+        return;
+    }
+
+    ret = esp_now_register_recv_cb(espnow_group_receive);
+    ESP_ERROR_CHECK(ret);
+}
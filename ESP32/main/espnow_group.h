@@ -0,0 +1,48 @@
+#pragma once
+
+/* Layout of a group command, multi-byte fields are little endian. The
+ * header is followed by up to FIRING_MAX_CHANNELS operations. The sequence
+ * number of a sender must increase, except after 10 seconds without an
+ * accepted command, when any value is taken again, as after a reboot. */
+#define ESPNOW_GROUP_MAGIC 0x4D44
+#define ESPNOW_GROUP_PACKET_MAGIC 0
+#define ESPNOW_GROUP_PACKET_GROUPS 2
+#define ESPNOW_GROUP_PACKET_SEQUENCE 6
+#define ESPNOW_GROUP_PACKET_DELAY 10
+#define ESPNOW_GROUP_PACKET_COUNT 12
+#define ESPNOW_GROUP_HEADER_LENGTH 13
+
+/* Layout of an operation of a group command */
+#define ESPNOW_GROUP_OPERATION_CHANNEL 0
+#define ESPNOW_GROUP_OPERATION_LEVEL 1
+#define ESPNOW_GROUP_OPERATION_FADE 3
+#define ESPNOW_GROUP_OPERATION_EASING 5
+#define ESPNOW_GROUP_OPERATION_LENGTH 6
+
+/* Channel addressing all the channels at once */
+#define ESPNOW_GROUP_CHANNEL_ALL 0xFF
+
+/**
+ * @brief Starts receiving the ESP-NOW group commands.
+ *
+ * A group command carries a mask of groups, a sequence number, an
+ * execution delay and a list of channel operations. The dimmers that
+ * belong to one of the groups of CONFIG_DIMMER_ESPNOW_GROUPS apply the
+ * operations as a single batch, on the first mains cycle starting after
+ * the delay from the reception.
+ *
+ * A broadcast frame reaches all the dimmers at the same time within a few
+ * tens of microseconds, so the reception is the shared time reference, and
+ * dimmers on the same mains start together on the same cycle. Senders may
+ * repeat a command for reliability, the repetitions carry the same sequence
+ * number and are dropped. A sender is forgotten 10 seconds after its last
+ * accepted command, so a rebooted group controller, which keeps its MAC
+ * address but counts again from a low sequence number, is followed again
+ * after at most that time.
+ *
+ * Must be called once Wi-Fi is started. All the dimmers and the sender
+ * must be on the same Wi-Fi channel.
+ *
+ * @return void
+ */
+void espnow_group_init(void);
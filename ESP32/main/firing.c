@@ -0,0 +1,377 @@
+#include "firing.h"
+#include "driver/mcpwm_prelude.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "power_profile.h"
+
+/* Firing timer runs at 1 MHz, so one tick is one microsecond */
+#define FIRING_TIMER_RESOLUTION_HZ 1000000
+
+/* Timer period, long enough to cover powergrid periods down to 25 Hz */
+#define FIRING_TIMER_PERIOD_TICKS 40000
+
+/* Time before the next expected edge where the gate is released */
+#define FIRING_GATE_GUARD_US 200
+
+/* Shortest delay, leaves room for the ISR latency in same-cycle scheduling */
+#define FIRING_MIN_DELAY_US 100
+
+/* Checks of the driver calls on the firing path, whose arguments are all
+ * validated beforehand, compiled out in release builds */
+#if CONFIG_DIMMER_FIRING_CHECKS
+#define FIRING_CHECK(x) ESP_ERROR_CHECK(x)
+#else
+#define FIRING_CHECK(x) ((void)(x))
+#endif
+
+/**
+ * @brief Hardware and state of a firing channel.
+ *
+ * Each channel owns an MCPWM operator, so its comparators and its generator
+ * never interfere with the other channels.
+ */
+typedef struct {
+    /* MCPWM handles of the channel */
+    mcpwm_oper_handle_t oper;
+    mcpwm_cmpr_handle_t fire_comparator;
+    mcpwm_cmpr_handle_t release_comparator;
+    mcpwm_gen_handle_t gate_generator;
+
+    /* Flag holding whether the gate output is forced low */
+    bool is_gate_forced;
+
+    /* Gate pulse shape, a zero width holds the gate until the window end */
+    firing_pulse_t gate_pulse;
+
+    /* Pulse train state, owned by the ISRs of the firing engine */
+    uint32_t pulses_left;
+    uint32_t pulse_end;
+    uint32_t pulse_width;
+    uint32_t pulse_gap;
+} firing_channel_t;
+
+/* Timer and zero-crossing synchronization of each MCPWM group */
+static mcpwm_timer_handle_t firing_timers[SOC_MCPWM_GROUPS];
+static mcpwm_sync_handle_t zero_crossing_syncs[SOC_MCPWM_GROUPS];
+
+/* Firing channels, filling the operators of one group after the other */
+static firing_channel_t channels[FIRING_MAX_CHANNELS];
+static size_t channel_count = 0;
+
+#if CONFIG_DIMMER_GATE_PULSE_TRAIN
+/**
+ * @brief Callback of the release comparator, runs in the ISR.
+ *
+ * Only registered for pulse trains. Moves both comparators forward to the 
+ * next pulse of the train, while it still fits in the firing window.
+ *
+ * @param comparator Release comparator.
+ * @param edata Compare value that was reached.
+ * @param user_ctx Channel owning the comparator.
+ *
+ * @return false, no task is woken up.
+ */
+static bool IRAM_ATTR firing_release_isr(mcpwm_cmpr_handle_t comparator,
+                                         const mcpwm_compare_event_data_t *edata,
+                                         void *user_ctx)
+{
+    firing_channel_t *channel = user_ctx;
+
+    if (channel->pulses_left == 0) {
+        return false;
+    }
+
+    const uint32_t next = edata->compare_ticks + channel->pulse_gap;
+
+    if (next + channel->pulse_width <= channel->pulse_end) {
+        mcpwm_comparator_set_compare_value(channel->fire_comparator, next);
+        mcpwm_comparator_set_compare_value(channel->release_comparator,
+                                           next + channel->pulse_width);
+        channel->pulses_left--;
+    } else {
+        channel->pulses_left = 0;
+    }
+
+    return false;
+}
+#endif
+
+/**
+ * @brief Creates the timer of an MCPWM group, reset by the zero-crossing.
+ *
+ * @param group MCPWM group.
+ * @param sync_pin Zero-crossing input used to synchronize the timer.
+ *
+ * @return void
+ */
+static void firing_group_init(int group, gpio_num_t sync_pin)
+{
+    esp_err_t ret;
+
+    /* Free running timer, reset in hardware on every rising edge */
+    const mcpwm_timer_config_t timer_config = {
+        .group_id = group,
+        .clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT,
+        .resolution_hz = FIRING_TIMER_RESOLUTION_HZ,
+        .count_mode = MCPWM_TIMER_COUNT_MODE_UP,
+        .period_ticks = FIRING_TIMER_PERIOD_TICKS,
+        .intr_priority = power_profile_intr_priority(),
+    };
+
+    ret = mcpwm_new_timer(&timer_config, &firing_timers[group]);
+    ESP_ERROR_CHECK(ret);
+
+    /* Reset the timer counter on the rising edge of the zero-crossing input */
+    const mcpwm_gpio_sync_src_config_t sync_config = {
+        .group_id = group,
+        .gpio_num = sync_pin,
+#if CONFIG_DIMMER_BENCHMARK
+        /* The benchmark drives the synthetic edges from this chip */
+        .flags.io_loop_back = true,
+#endif
+    };
+
+    ret = mcpwm_new_gpio_sync_src(&sync_config, &zero_crossing_syncs[group]);
+    ESP_ERROR_CHECK(ret);
+
+    const mcpwm_timer_sync_phase_config_t sync_phase_config = {
+        .sync_src = zero_crossing_syncs[group],
+        .count_value = 0,
+        .direction = MCPWM_TIMER_DIRECTION_UP,
+    };
+
+    ret = mcpwm_timer_set_phase_on_sync(firing_timers[group],
+                                        &sync_phase_config);
+    ESP_ERROR_CHECK(ret);
+}
+
+/**
+ * @brief Creates the operator, comparators and generator of a channel.
+ *
+ * @param channel Channel to initialize.
+ * @param group MCPWM group of the channel.
+ * @param gate_pin Output pin connected to the TRIAC driver.
+ *
+ * @return void
+ */
+static void firing_channel_init(firing_channel_t *channel, int group,
+                                gpio_num_t gate_pin)
+{
+    esp_err_t ret;
+
+    /* Every interrupt of a group shares the level of the edge capture */
+    const mcpwm_operator_config_t operator_config = {
+        .group_id = group,
+        .intr_priority = power_profile_intr_priority(),
+    };
+
+    ret = mcpwm_new_operator(&operator_config, &channel->oper);
+    ESP_ERROR_CHECK(ret);
+
+    ret = mcpwm_operator_connect_timer(channel->oper, firing_timers[group]);
+    ESP_ERROR_CHECK(ret);
+
+#if CONFIG_DIMMER_ISR_SCHEDULING
+    /* Compare values apply immediately, the edge ISR schedules its own cycle */
+    const mcpwm_comparator_config_t comparator_config = {
+        .intr_priority = power_profile_intr_priority(),
+    };
+#else
+    /* Compare values are latched on the zero-crossing synchronization */
+    const mcpwm_comparator_config_t comparator_config = {
+        .intr_priority = power_profile_intr_priority(),
+        .flags.update_cmp_on_sync = true,
+    };
+#endif
+
+    ret = mcpwm_new_comparator(channel->oper, &comparator_config,
+                               &channel->fire_comparator);
+    ESP_ERROR_CHECK(ret);
+
+    ret = mcpwm_new_comparator(channel->oper, &comparator_config,
+                               &channel->release_comparator);
+    ESP_ERROR_CHECK(ret);
+
+    const mcpwm_generator_config_t generator_config = {
+        .gen_gpio_num = gate_pin,
+    };
+
+    ret = mcpwm_new_generator(channel->oper, &generator_config,
+                              &channel->gate_generator);
+    ESP_ERROR_CHECK(ret);
+
+    /* Keep the gate low until the first trigger is scheduled */
+    ret = mcpwm_generator_set_force_level(channel->gate_generator, 0, true);
+    ESP_ERROR_CHECK(ret);
+
+    channel->is_gate_forced = true;
+
+    /* Gate goes high on the fire compare and low on the release compare */
+    ret = mcpwm_generator_set_action_on_compare_event(
+        channel->gate_generator,
+        MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP,
+                                       channel->fire_comparator,
+                                       MCPWM_GEN_ACTION_HIGH));
+    ESP_ERROR_CHECK(ret);
+
+    ret = mcpwm_generator_set_action_on_compare_event(
+        channel->gate_generator,
+        MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP,
+                                       channel->release_comparator,
+                                       MCPWM_GEN_ACTION_LOW));
+    ESP_ERROR_CHECK(ret);
+
+#if CONFIG_DIMMER_GATE_PULSE_TRAIN
+    /* Chain the pulses of a train from the release compare */
+    const mcpwm_comparator_event_callbacks_t release_callbacks = {
+        .on_reach = firing_release_isr,
+    };
+
+    ret = mcpwm_comparator_register_event_callbacks(
+        channel->release_comparator, &release_callbacks, channel);
+    ESP_ERROR_CHECK(ret);
+#endif
+
+    /* Release the gate if the timer overflows without zero-crossing edges */
+    ret = mcpwm_generator_set_action_on_timer_event(
+        channel->gate_generator,
+        MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP,
+                                     MCPWM_TIMER_EVENT_FULL,
+                                     MCPWM_GEN_ACTION_LOW));
+    ESP_ERROR_CHECK(ret);
+
+    /* Default gate pulse shape from the configuration */
+#if CONFIG_DIMMER_GATE_PULSE_TRAIN
+    channel->gate_pulse.width = CONFIG_DIMMER_GATE_PULSE_WIDTH_US;
+    channel->gate_pulse.count = CONFIG_DIMMER_GATE_PULSE_COUNT;
+    channel->gate_pulse.gap = CONFIG_DIMMER_GATE_PULSE_GAP_US;
+#elif CONFIG_DIMMER_GATE_DRIVE_PULSE
+    channel->gate_pulse.width = CONFIG_DIMMER_GATE_PULSE_WIDTH_US;
+    channel->gate_pulse.count = 1;
+    channel->gate_pulse.gap = 0;
+#else
+    channel->gate_pulse.width = 0;
+    channel->gate_pulse.count = 1;
+    channel->gate_pulse.gap = 0;
+#endif
+}
+
+void firing_init(gpio_num_t sync_pin, const gpio_num_t *gate_pins,
+                 size_t count)
+{
+    esp_err_t ret;
+
+    if (count > FIRING_MAX_CHANNELS) {
+        count = FIRING_MAX_CHANNELS;
+    }
+
+    const int groups = (count + SOC_MCPWM_OPERATORS_PER_GROUP - 1) /
+                       SOC_MCPWM_OPERATORS_PER_GROUP;
+
+    for (int group = 0; group < groups; group++) {
+        firing_group_init(group, sync_pin);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        firing_channel_init(&channels[i], i / SOC_MCPWM_OPERATORS_PER_GROUP,
+                            gate_pins[i]);
+    }
+
+    channel_count = count;
+
+    /* All the timers are reset by the same edge, so they stay in phase */
+    for (int group = 0; group < groups; group++) {
+        ret = mcpwm_timer_enable(firing_timers[group]);
+        ESP_ERROR_CHECK(ret);
+
+        ret = mcpwm_timer_start_stop(firing_timers[group],
+                                     MCPWM_TIMER_START_NO_STOP);
+        ESP_ERROR_CHECK(ret);
+    }
+}
+
+size_t firing_channel_count(void)
+{
+    return channel_count;
+}
+
+void IRAM_ATTR firing_set_delay(size_t index, uint32_t delay, uint32_t end)
+{
+    esp_err_t ret;
+
+    if (index >= channel_count) {
+        return;
+    }
+
+    firing_channel_t *channel = &channels[index];
+
+    /* The timer already counts from the edge when the ISR gets here */
+    if (delay < FIRING_MIN_DELAY_US) {
+        delay = FIRING_MIN_DELAY_US;
+    }
+
+    /* Hold the gate low while the trigger is in the dead zone */
+    if (end <= FIRING_GATE_GUARD_US || end >= FIRING_TIMER_PERIOD_TICKS ||
+        delay >= end - FIRING_GATE_GUARD_US) {
+
+        if (!channel->is_gate_forced) {
+            ret = mcpwm_generator_set_force_level(channel->gate_generator, 0,
+                                                  true);
+            FIRING_CHECK(ret);
+
+            channel->is_gate_forced = true;
+        }
+
+        channel->pulses_left = 0;
+        return;
+    }
+
+    /* Release on the window end, or after a single short pulse */
+    const firing_pulse_t *pulse = &channel->gate_pulse;
+    uint32_t release = end - FIRING_GATE_GUARD_US;
+
+    if (pulse->width != 0 && delay + pulse->width < release) {
+        channel->pulse_end = release;
+        channel->pulse_width = pulse->width;
+        channel->pulse_gap = pulse->gap;
+        channel->pulses_left = pulse->count - 1;
+
+        release = delay + pulse->width;
+    } else {
+        channel->pulses_left = 0;
+    }
+
+    ret = mcpwm_comparator_set_compare_value(channel->fire_comparator, delay);
+    FIRING_CHECK(ret);
+
+    ret = mcpwm_comparator_set_compare_value(channel->release_comparator,
+                                             release);
+    FIRING_CHECK(ret);
+
+    /* Hand the gate back to the generator actions */
+    if (channel->is_gate_forced) {
+        ret = mcpwm_generator_set_force_level(channel->gate_generator, -1,
+                                              true);
+        FIRING_CHECK(ret);
+
+        channel->is_gate_forced = false;
+    }
+}
+
+void firing_set_pulse(size_t index, const firing_pulse_t *pulse)
+{
+    if (index >= channel_count) {
+        return;
+    }
+
+    firing_pulse_t *gate_pulse = &channels[index].gate_pulse;
+
+    gate_pulse->width = pulse->width;
+    gate_pulse->count = (pulse->count > 0) ? pulse->count : 1;
+    gate_pulse->gap = pulse->gap;
+
+#if !CONFIG_DIMMER_GATE_PULSE_TRAIN
+    /* Trains need the release comparator callback */
+    gate_pulse->count = 1;
+#endif
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "soc/soc_caps.h"
+
+/* One channel per MCPWM operator, in all the MCPWM groups */
+#define FIRING_MAX_CHANNELS \
+    (SOC_MCPWM_GROUPS * SOC_MCPWM_OPERATORS_PER_GROUP)
+
+/**
+ * @brief Shape of the gate drive in each half-cycle.
+ */
+typedef struct {
+    /* Pulse width in microseconds, 0 holds the gate until the window end */
+    uint32_t width;
+
+    /* Pulses per half-cycle, more than one needs a pulse train build */
+    uint32_t count;
+
+    /* Gap between the pulses of a train in microseconds */
+    uint32_t gap;
+} firing_pulse_t;
+
+/**
+ * @brief Initializes the hardware TRIAC firing engine.
+ *
+ * Each MCPWM group in use has a timer whose counter is reset in hardware by
+ * the rising edge of the zero-crossing signal. Every channel owns an
+ * operator of that group, whose two comparators turn the gate output on and
+ * off, so the gate pins are driven straight from the peripheral without any
+ * CPU involvement. The cost of a cycle is one comparator update per channel.
+ *
+ * @param sync_pin Zero-crossing input used to synchronize the timers.
+ * @param gate_pins Output pins connected to the TRIAC drivers.
+ * @param count Number of channels, up to FIRING_MAX_CHANNELS.
+ *
+ * @return void
+ */
+void firing_init(gpio_num_t sync_pin, const gpio_num_t *gate_pins,
+                 size_t count);
+
+/**
+ * @brief Gets the number of channels of the firing engine.
+ *
+ * @return Number of channels.
+ */
+size_t firing_channel_count(void);
+
+/**
+ * @brief Schedules the TRIAC trigger.
+ *
+ * With CONFIG_DIMMER_ISR_SCHEDULING the values apply immediately. Since the
+ * timer has been reset by the edge itself, calling this from the edge ISR
+ * fires the current cycle exactly at the delay, whatever the ISR latency.
+ * Otherwise the values are latched by the hardware on the next zero-crossing
+ * synchronization, so they never take effect in the middle of a cycle.
+ *
+ * When the delay falls inside the dead zone the gate is held low. Safe to
+ * call from an ISR, the MCPWM control functions are placed in IRAM.
+ *
+ * @param channel Index of the channel.
+ * @param delay Trigger delay from the rising edge in microseconds.
+ * @param end End of the half-cycle from the rising edge in microseconds, 
+ * which is the powergrid sine period when firing once per period.
+ *
+ * @return void
+ */
+void firing_set_delay(size_t channel, uint32_t delay, uint32_t end);
+
+/**
+ * @brief Sets the shape of the gate drive.
+ *
+ * A single pulse is generated entirely by the comparators. The following
+ * pulses of a train are chained from a short comparator ISR, only present
+ * with CONFIG_DIMMER_GATE_PULSE_TRAIN. Takes effect on the next trigger.
+ *
+ * @param channel Index of the channel.
+ * @param pulse Shape of the gate drive.
+ *
+ * @return void
+ */
+void firing_set_pulse(size_t channel, const firing_pulse_t *pulse);
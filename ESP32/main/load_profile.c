@@ -0,0 +1,128 @@
+#include "load_profile.h"
+#include <stdbool.h>
+#include <string.h>
+#include "firing.h"
+#include "phase_lut.h"
+#include "sdkconfig.h"
+
+/* Number of TRIAC channels driven from the zero-crossing input */
+#define CHANNEL_COUNT CONFIG_DIMMER_CHANNEL_COUNT
+
+/* Settings of a profile */
+typedef struct {
+    const char *name;
+
+    /* Conduction window, in thousandths of the half-cycle */
+    uint16_t min_conduction;
+    uint16_t max_conduction;
+
+    /* Flag holding whether a single short gate pulse may not latch */
+    bool is_retriggered;
+} load_profile_config_t;
+
+/* Settings of every profile, in enumeration order */
+static const load_profile_config_t profile_configs[LOAD_PROFILE_MAX] = {
+    [LOAD_PROFILE_RESISTIVE] = {
+        .name = "resistive",
+        .min_conduction = 0,
+        .max_conduction = PHASE_LUT_CONDUCTION_MAX,
+        .is_retriggered = false,
+    },
+    /* The driver input capacitor draws current in short peaks, and its
+     * supply drops out below about a fifth of the half-cycle */
+    [LOAD_PROFILE_LED] = {
+        .name = "led",
+        .min_conduction = 200,
+        .max_conduction = 950,
+        .is_retriggered = true,
+    },
+    /* Fired before the current of the previous half-cycle crosses zero,
+     * the gate pulse would find the TRIAC still conducting */
+    [LOAD_PROFILE_INDUCTIVE] = {
+        .name = "inductive",
+        .min_conduction = 100,
+        .max_conduction = 850,
+        .is_retriggered = true,
+    },
+};
+
+/* Profile of every channel */
+static load_profile_t profiles[CHANNEL_COUNT];
+
+/**
+ * @brief Sets the gate drive of a channel from its profile.
+ *
+ * Only the short pulse drive has something to change, the gate held until
+ * the end of the half-cycle retriggers the TRIAC by itself.
+ *
+ * @param channel Index of the channel.
+ *
+ * @return void
+ */
+static void load_profile_apply_pulse(size_t channel)
+{
+#if CONFIG_DIMMER_GATE_DRIVE_PULSE
+    firing_pulse_t pulse = {
+        .width = CONFIG_DIMMER_GATE_PULSE_WIDTH_US,
+        .count = 1,
+        .gap = 0,
+    };
+
+    if (profile_configs[profiles[channel]].is_retriggered) {
+#if CONFIG_DIMMER_GATE_PULSE_TRAIN
+        pulse.count = CONFIG_DIMMER_GATE_PULSE_COUNT;
+        pulse.gap = CONFIG_DIMMER_GATE_PULSE_GAP_US;
+#else
+        /* No trains, hold the gate until the end of the half-cycle */
+        pulse.width = 0;
+#endif
+    }
+
+    firing_set_pulse(channel, &pulse);
+#endif
+}
+
+void load_profile_init(void)
+{
+    for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+        load_profile_apply_pulse(channel);
+    }
+}
+
+void load_profile_set(size_t channel, load_profile_t profile)
+{
+    if (channel >= CHANNEL_COUNT || profile >= LOAD_PROFILE_MAX) {
+        return;
+    }
+
+    const load_profile_config_t *config = &profile_configs[profile];
+
+    profiles[channel] = profile;
+
+    phase_lut_set_conduction(channel, config->min_conduction,
+                             config->max_conduction);
+    load_profile_apply_pulse(channel);
+}
+
+load_profile_t load_profile_get(size_t channel)
+{
+    return (channel < CHANNEL_COUNT) ? profiles[channel]
+                                     : LOAD_PROFILE_RESISTIVE;
+}
+
+const char *load_profile_name(load_profile_t profile)
+{
+    return (profile < LOAD_PROFILE_MAX) ? profile_configs[profile].name
+                                        : NULL;
+}
+
+load_profile_t load_profile_from_name(const char *name)
+{
+    for (int i = 0; i < LOAD_PROFILE_MAX; i++) {
+        if (strcmp(name, profile_configs[i].name) == 0) {
+            return (load_profile_t)i;
+        }
+    }
+
+    return LOAD_PROFILE_MAX;
+}
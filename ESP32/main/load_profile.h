@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief Kinds of loads, each with its conduction window and gate drive.
+ *
+ * The TRIAC can only be turned on, it turns off by itself when the load
+ * current crosses zero, so every profile is a leading-edge profile.
+ */
+typedef enum {
+    /* Incandescent and halogen lamps, the whole half-cycle */
+    LOAD_PROFILE_RESISTIVE = 0,
+
+    /* Dimmable LED drivers, which flicker below a minimum conduction */
+    LOAD_PROFILE_LED,
+
+    /* Transformers and motors, whose current lags the voltage */
+    LOAD_PROFILE_INDUCTIVE,
+
+    LOAD_PROFILE_MAX,
+} load_profile_t;
+
+/**
+ * @brief Applies the gate drive of the profiles to the firing engine.
+ *
+ * Must be called after firing_init(), the profiles set before only reach
+ * the lookup tables.
+ *
+ * @return void
+ */
+void load_profile_init(void);
+
+/**
+ * @brief Sets the load profile of a channel.
+ *
+ * Rebuilds the lookup table of the channel with the conduction window of
+ * the profile, and retriggers the gate within the half-cycle for the loads
+ * that may not latch the TRIAC on a single pulse. Nothing changes in the
+ * firing path, which costs the same for every profile.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ * @param profile Profile of the load.
+ *
+ * @return void
+ */
+void load_profile_set(size_t channel, load_profile_t profile);
+
+/**
+ * @brief Gets the load profile of a channel.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ *
+ * @return Profile of the load.
+ */
+load_profile_t load_profile_get(size_t channel);
+
+/**
+ * @brief Gets the name of a profile, as used by the HTTP API.
+ *
+ * @param profile Profile of the load.
+ *
+ * @return Name of the profile, NULL for an unknown profile.
+ */
+const char *load_profile_name(load_profile_t profile);
+
+/**
+ * @brief Finds a profile from its name.
+ *
+ * @param name Name of the profile.
+ *
+ * @return Profile, LOAD_PROFILE_MAX if the name is unknown.
+ */
+load_profile_t load_profile_from_name(const char *name);
@@ -1,6 +1,5 @@
-#include <netdb.h>
 #include "driver/gpio.h"
-#include "esp_wifi.h"
+#include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
@@ -8,169 +7,194 @@
 #include "freertos/task.h"
 #include "lwip/err.h"
 #include "nvs_flash.h"
+#include "cJSON.h"
+#include "firing.h"
+#include "dimmer_state.h"
+#include "phase_lut.h"
+#include "load_profile.h"
+#include "energy.h"
+#include "mains_tracker.h"
+#include "mains_watchdog.h"
+#include "edge_capture.h"
+#include "zero_crossing.h"
+#include "transition.h"
+#include "ws_control.h"
+#include "udp_control.h"
+#include "network.h"
+#include "espnow_group.h"
+#include "ble_control.h"
+#include "power_profile.h"
+#include "settings.h"
+#include "metrics.h"
+#include "ota.h"
+#include "benchmark.h"
+
+/* GPIO */
+#if CONFIG_DIMMER_BENCHMARK
+/* Synthetic edges looped back inside the chip, the detector is ignored */
+#define INPUT_PIN ((gpio_num_t)CONFIG_DIMMER_BENCHMARK_PIN)
+#else
+#define INPUT_PIN GPIO_NUM_27
+#endif
 
-/* Wifi Config */
-#define WIFI_SSID "DIMMER"
-#define WIFI_PASS "password"
-#define WIFI_CHANNEL 1
-#define MAX_STA_CONN 1
+/* Number of TRIAC channels driven from the zero-crossing input */
+#define CHANNEL_COUNT CONFIG_DIMMER_CHANNEL_COUNT
 
-/* IP config for the WiFi AP */
-#define STATIC_IP_ADDR "192.168.1.1"
-#define GATEWAY_ADDR "192.168.1.1"
-#define NETMASK_ADDR "255.255.255.0"
+/* Stack size of the control task, large enough for the MCPWM driver setup */
+#define CONTROL_TASK_STACK_SIZE 4096
 
-/* Interruption and GPIO */
-#define ESP_INTR_FLAG_DEFAULT 0
-#define INPUT_PIN GPIO_NUM_27
-#define OUTPUT_PIN GPIO_NUM_33
+/* Largest body accepted by the scene endpoint */
+#define SCENE_MAX_BODY_LENGTH 1024
 
-/* Task Handle */
-static TaskHandle_t task_handle = NULL;
+/* Largest body accepted by the Wi-Fi provisioning endpoint */
+#define WIFI_MAX_BODY_LENGTH 256
 
-/* Timestamps used in logic flow and trigger calculation */
-static uint64_t rising_time = 0;
-static uint64_t falling_time = 0;
-static uint64_t zero_crossing_time = 0;
-static uint64_t trigger_time = 0;
+/* Time left to send the provisioning response before rebooting */
+#define WIFI_RESTART_DELAY_MS 500
 
-/* Powergrid sine period in us */
-static uint16_t period = 0;
+/* URI handlers registered on the HTTP server, with some spare */
+#define HTTP_MAX_URI_HANDLERS 12
 
-/* Brightness intensity in percentage */
-static uint8_t brightness = 0;
+/* Power profile used at boot */
+#if CONFIG_DIMMER_POWER_PROFILE_LOW_LATENCY
+#define BOOT_POWER_PROFILE POWER_PROFILE_LOW_LATENCY
+#elif CONFIG_DIMMER_POWER_PROFILE_LOW_POWER
+#define BOOT_POWER_PROFILE POWER_PROFILE_LOW_POWER
+#else
+#define BOOT_POWER_PROFILE POWER_PROFILE_BALANCED
+#endif
 
-/* Flags used in the logic flow */
-static bool is_crossing_zero = false;
-static bool is_triggering = false;
+/* Gate output of each channel, in channel order */
+static const gpio_num_t output_pins[FIRING_MAX_CHANNELS] = {
+    GPIO_NUM_33, GPIO_NUM_32, GPIO_NUM_25, GPIO_NUM_26, GPIO_NUM_13, GPIO_NUM_14,
+};
 
-/* Timer used to trigger the TRIAC */
-static esp_timer_handle_t trigger_timer;
+/* Task Handle */
+static TaskHandle_t task_handle = NULL;
 
 /**
  * @brief Interrupt Service Routine (ISR) for zero-crossing detection.
  *
  * This ISR is triggered on both rising and falling edges of the input signal. 
- * It manages the timing and triggering of actions based on zero-crossing 
- * events, adjusting the timer and updating the state variables accordingly.
+ * The edges are timestamped by the hardware capture and processed by the 
+ * zero-crossing module. The TRIAC itself is fired by the hardware firing 
+ * engine. With CONFIG_DIMMER_ISR_SCHEDULING the ISR also calculates the 
+ * trigger delay with integer math only, otherwise it wakes the control task 
+ * to do it.
  *
- * @param arg Not used in this implementation.
+ * @param current_time Timestamp of the edge in microseconds.
+ * @param current_state Level of the input after the edge.
+ *
+ * @return true if the control task must run right after the ISR.
  */
-void IRAM_ATTR crossing_zero_isr_handler(void *arg)
+static bool IRAM_ATTR crossing_zero_isr_handler(uint64_t current_time,
+                                                bool current_state)
 {
-    esp_err_t ret;
-
-    const uint64_t current_time = esp_timer_get_time();
-    const bool current_state = gpio_get_level(INPUT_PIN);
-
-    /* Rising edge detected */
-    if (current_state && !is_crossing_zero) {
-        /* Turnoff the active trigger */
-        ret = gpio_set_level(OUTPUT_PIN, 0);
-        ESP_ERROR_CHECK(ret);
-
-        /* If there is no trigger active and trigger isn't in the dead zone */
-        if (!is_triggering && trigger_time < period) {
-            ret = esp_timer_start_once(trigger_timer, trigger_time);
-            ESP_ERROR_CHECK(ret);
-
-            is_triggering = true;
-        }
-
-        /* Store the period in microseconds to calculate the trigger time */
-        period = current_time - rising_time;
-        rising_time = current_time;
-
-    /* Falling edge detected */
-    } else if (!current_state && is_crossing_zero) {
-        /* Store the falling time to estimate the zero-crossing time */
-        falling_time = current_time;
+    if (!zero_crossing_edge(current_time, current_state)) {
+        return false;
     }
 
-    /* Update the zero-crossing state */
-    is_crossing_zero = current_state;
-
     /* Resume a task from ISR */
-    xTaskResumeFromISR(task_handle);
+    return xTaskResumeFromISR(task_handle) == pdTRUE;
 }
 
 /**
- * @brief Callback function for the trigger timer.
+ * @brief Interrupt Service Routine (ISR) for the loss of the edges.
  *
- * This function is called when the timer expires. It toggles the output 
- * pin to generate a trigger signal. After the sequence, the 
- * `is_triggering` flag is set to false.
+ * Triggered by the edge watchdog when no genuine rising edge came for 1.5 
+ * periods. The zero-crossing module holds the gates low, from the ISR with 
+ * CONFIG_DIMMER_ISR_SCHEDULING, otherwise it wakes the control task to do it.
  *
- * @param arg Not used in this implementation.
+ * @return true if the control task must run right after the ISR.
  */
-static void trigger_timer_callback(void *arg)
+static bool IRAM_ATTR mains_timeout_isr_handler(void)
 {
-    esp_err_t ret;
+    if (!zero_crossing_timeout()) {
+        return false;
+    }
 
-    /* Activate the trigger */
-    ret = gpio_set_level(OUTPUT_PIN, 1);
-    ESP_ERROR_CHECK(ret);
-    is_triggering = false;
+    /* Resume a task from ISR */
+    return xTaskResumeFromISR(task_handle) == pdTRUE;
 }
 
 /**
  * @brief Controls the operation of a smart dimmer system.
  *
  * This function initializes and manages the operation of a smart dimmer 
- * system. It configures timers, GPIO pins, interrupt service routines, 
- * and tasks to controlthe brightness of a lighting system based on 
+ * system. It configures the firing engine, the edge capture, interrupt 
+ * service routines, and tasks to control the brightness of a lighting system based on 
  * zero-crossing detection. The system adjusts the brightness of the lights 
- * according to the detected brightness level and zero-crossing timing.
+ * according to the detected brightness level and zero-crossing timing. 
+ * When the ISR calculates the trigger itself the task deletes itself once 
+ * the setup is done.
  *
  * @param arg Not used in this implementation.
  */
 void smart_dimmer_control(void *arg)
 {
-    esp_err_t ret;
-
-    /* Timer configuration structure and creation */
-    const esp_timer_create_args_t trigger_timer_args = {
-        .callback = &trigger_timer_callback, 
-        .name = "trigger"
-    };
-
-    ret = esp_timer_create(&trigger_timer_args, &trigger_timer);
-    ESP_ERROR_CHECK(ret);
+    /* Start unlocked, the first edges acquire the powergrid period */
+    zero_crossing_init();
 
-    /* Configure GPIO input */
-    esp_rom_gpio_pad_select_gpio(INPUT_PIN);
-    ret = gpio_set_direction(INPUT_PIN, GPIO_MODE_INPUT);
-    ESP_ERROR_CHECK(ret);
+    /* Build the brightness curves before the first trigger */
+    phase_lut_init();
 
-    ret = gpio_set_intr_type(INPUT_PIN, GPIO_INTR_ANYEDGE);
-    ESP_ERROR_CHECK(ret);
+    /* Drive the TRIACs from hardware timers synchronized to the input */
+    firing_init(INPUT_PIN, output_pins, CHANNEL_COUNT);
 
-    ret = gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-    ESP_ERROR_CHECK(ret);
+    /* Gate drive of the load profiles, restored before the engine ran */
+    load_profile_init();
 
-    /* Add the ISR handler for the specified GPIO pin */
-    ret = gpio_isr_handler_add(INPUT_PIN, crossing_zero_isr_handler, NULL);
-    ESP_ERROR_CHECK(ret);
+    /* Timestamp the zero-crossing edges with the hardware capture */
+    edge_capture_init(INPUT_PIN, crossing_zero_isr_handler);
 
-    /* Configure GPIO output */
-    ret = gpio_set_direction(OUTPUT_PIN, GPIO_MODE_OUTPUT);
-    ESP_ERROR_CHECK(ret);
+    /* Catch the edges stopping, on the same core and level as the capture */
+    mains_watchdog_init(mains_timeout_isr_handler);
 
+#if CONFIG_DIMMER_ISR_SCHEDULING
+    /* The ISR, allocated on this core, does the rest of the work */
+    vTaskDelete(NULL);
+#else
     /* Infinity loop */
     for (;;) {
         /* Suspend the task until it is resumed externally */
         vTaskSuspend(NULL);
 
-        if (is_crossing_zero) {
-            /* Calculate trigger time based on zero-crossing detection */
-            trigger_time = (uint64_t)((1 - brightness / 100.0f) * period +
-                                      zero_crossing_time);
+        /* Calculate the trigger time from the edges of the ISR */
+        zero_crossing_schedule();
+    }
+#endif
+}
 
-        } else if (!is_crossing_zero && rising_time != 0 && falling_time != 0) {
-            /* Calculate zero-crossing time */
-            zero_crossing_time = (uint64_t)((falling_time - rising_time) / 2);
+/**
+ * @brief Extracts an integer query parameter clamped to a range.
+ *
+ * @param query Query string of the request.
+ * @param key Name of the parameter.
+ * @param min Minimum accepted value.
+ * @param max Maximum accepted value.
+ * @param value Destination of the clamped value.
+ *
+ * @return ESP_OK if the parameter was found.
+ */
+static esp_err_t http_query_int(const char *query, const char *key, int min,
+                                int max, int *value)
+{
+    char param[8] = { 0 };
+
+    esp_err_t ret = httpd_query_key_value(query, key, param, sizeof(param));
+
+    if (ret == ESP_OK) {
+        *value = atoi(param);
+
+        /* Ensure value is within range */
+        if (*value > max) {
+            *value = max;
+        } else if (*value < min) {
+            *value = min;
         }
     }
+
+    return ret;
 }
 
 /**
@@ -178,7 +202,13 @@ void smart_dimmer_control(void *arg)
  * and responds with the brightness value.
  *
  * This function processes incoming HTTP GET requests to extract the 
- * "brightness" parameter from the URL query string.
+ * "brightness" parameter (percentage) from the URL query string. The 
+ * optional "level" parameter sets the brightness with the full resolution 
+ * of the lookup table, "curve" selects the brightness curve and "load" the 
+ * load profile by name, "rated" the power of the load in watts. All apply 
+ * to the channel given by "channel", the first one by default. The new 
+ * brightness is reached after "fade" milliseconds, following the "easing" 
+ * curve, and the response holds the brightness the channel is heading to.
  *
  * @param req Pointer to the HTTP request.
  * 
@@ -188,8 +218,11 @@ static esp_err_t http_request_handler(httpd_req_t *req)
 {
     esp_err_t ret;
 
-    char buffer[16];
+    const int64_t start_time = esp_timer_get_time();
+
+    char buffer[96];
     size_t buffer_length;
+    size_t channel = 0;
 
     buffer_length = httpd_req_get_url_query_len(req) + 1;
 
@@ -199,138 +232,542 @@ static esp_err_t http_request_handler(httpd_req_t *req)
         ret = httpd_req_get_url_query_str(req, buffer, buffer_length);
         
         if (ret == ESP_OK) {
-            char param[5] = { 0 };
-
-            ret = httpd_query_key_value(buffer, "brightness", 
-                                        param, sizeof(param));
-
-            /* Converts the "brightness" parameter value to an integer */
-            if (ret == ESP_OK) {
-                int value = atoi(param);
-
-                /* Ensure value is within range 0-100 */
-                if (value > 100) {
-                    brightness = 100;
-                } else if (value < 0) {
-                    brightness = 0;
-                } else {
-                    brightness = (uint8_t)value;
-                }
+            int value;
+            int fade = 0;
+            int easing = TRANSITION_EASING_LINEAR;
+
+            /* Channel addressed by the request */
+            if (http_query_int(buffer, "channel", 0, CHANNEL_COUNT - 1,
+                               &value) == ESP_OK) {
+                channel = value;
+            }
+
+            /* Brightness curve, applied before the new level */
+            if (http_query_int(buffer, "curve", 0, PHASE_LUT_CURVE_MAX - 1,
+                               &value) == ESP_OK) {
+                phase_lut_set_curve(channel, (phase_lut_curve_t)value);
             }
+
+            char name[16];
+
+            /* Load profile, unknown names are ignored */
+            if (httpd_query_key_value(buffer, "load", name, sizeof(name)) ==
+                ESP_OK) {
+                load_profile_set(channel, load_profile_from_name(name));
+            }
+
+            /* Power of the load at full conduction, for the energy */
+            if (http_query_int(buffer, "rated", 0, ENERGY_MAX_RATED_W,
+                               &value) == ESP_OK) {
+                energy_set_rated(channel, value);
+            }
+
+            /* Optional transition towards the new level */
+            http_query_int(buffer, "fade", 0, TRANSITION_MAX_DURATION_MS,
+                           &fade);
+            http_query_int(buffer, "easing", 0, TRANSITION_EASING_MAX - 1,
+                           &easing);
+
+            /* Brightness in percentage, or level in full resolution */
+            if (http_query_int(buffer, "brightness", 0, 100,
+                               &value) == ESP_OK) {
+                transition_start(channel, value * PHASE_LUT_LEVEL_MAX / 100,
+                                 fade, (transition_easing_t)easing);
+
+            } else if (http_query_int(buffer, "level", 0, PHASE_LUT_LEVEL_MAX,
+                                      &value) == ESP_OK) {
+                transition_start(channel, value, fade,
+                                 (transition_easing_t)easing);
+            }
+
+            /* Keep the WebSocket clients in sync */
+            ws_control_notify();
         }
     }
 
     /* Buffer to hold brightness value (up to 3 digits + null terminator) */
     char response_buffer[5];
 
-    snprintf(response_buffer, sizeof(response_buffer), "%d", brightness);
+    snprintf(response_buffer, sizeof(response_buffer), "%d",
+             (transition_get_target(channel) * 100 +
+              PHASE_LUT_LEVEL_MAX / 2) / PHASE_LUT_LEVEL_MAX);
 
     /* Send current brightness value as response */
     ret = httpd_resp_send(req, response_buffer, strlen(response_buffer));
     ESP_ERROR_CHECK(ret);
 
+    metrics_record(METRICS_HTTP_HANDLER,
+                   (int32_t)(esp_timer_get_time() - start_time));
+
     return ESP_OK;
 }
 
 /**
- * @brief Initializes and starts the HTTP server.
+ * @brief Handles HTTP GET requests to the status endpoint.
  *
- * @return void
+ * Responds with a JSON object holding the brightness, the curve, the load 
+ * profile and the transition state of every channel, and the state of the 
+ * powergrid period tracker.
+ *
+ * @param req Pointer to the HTTP request.
+ * 
+ * @return ESP_OK on success.
  */
-static void http_server_init(void)
+static esp_err_t http_status_handler(httpd_req_t *req)
 {
     esp_err_t ret;
 
-    /* Creates an HTTP server handle and default server configuration */
-    httpd_handle_t server = NULL;
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    dimmer_edges_t edges;
 
-    if (httpd_start(&server, &config) == ESP_OK) {
-        httpd_uri_t root_uri = { 
-            .uri = "/",
-            .method = HTTP_GET,
-            .handler = http_request_handler,
-            .user_ctx = NULL 
-        };
+    dimmer_state_read_edges(&edges);
 
-        /* Registers a URI handler for the root ("/") endpoint */
-        ret = httpd_register_uri_handler(server, &root_uri);
-        ESP_ERROR_CHECK(ret);
+    const uint32_t frequency = mains_tracker_frequency(edges.period);
 
-    } else {
-        ESP_LOGE("HTTP_SERVER", "Failed to start server");
+    char response_buffer[768];
+    int length = 0;
+
+    length += snprintf(response_buffer + length,
+                       sizeof(response_buffer) - length, "{\"channels\":[");
+
+    for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+        length += snprintf(response_buffer + length,
+                           sizeof(response_buffer) - length,
+                           "%s{\"level\":%u,\"curve\":%d,\"load\":\"%s\","
+                           "\"target\":%u,\"fading\":%s}",
+                           (channel > 0) ? "," : "",
+                           dimmer_state_get_level(channel),
+                           phase_lut_get_curve(channel),
+                           load_profile_name(load_profile_get(channel)),
+                           transition_get_target(channel),
+                           transition_is_active(channel) ? "true" : "false");
+    }
+
+    snprintf(response_buffer + length, sizeof(response_buffer) - length,
+             "],\"locked\":%s,\"mains_lost\":%s,\"period\":%lu,"
+             "\"frequency\":%lu.%03lu,\"profile\":\"%s\"}",
+             edges.is_locked ? "true" : "false",
+             edges.is_mains_lost ? "true" : "false",
+             (unsigned long)edges.period,
+             (unsigned long)(frequency / 1000),
+             (unsigned long)(frequency % 1000),
+             power_profile_name(power_profile_get()));
+
+    ret = httpd_resp_set_type(req, "application/json");
+    ESP_ERROR_CHECK(ret);
+
+    ret = httpd_resp_send(req, response_buffer, strlen(response_buffer));
+    ESP_ERROR_CHECK(ret);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Extracts an integer member of a JSON object clamped to a range.
+ *
+ * @param object JSON object.
+ * @param key Name of the member.
+ * @param min Minimum accepted value.
+ * @param max Maximum accepted value.
+ * @param value Destination of the clamped value.
+ *
+ * @return ESP_OK if the member was found and is a number.
+ */
+static esp_err_t json_get_int(const cJSON *object, const char *key, int min,
+                              int max, int *value)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(object, key);
+
+    if (!cJSON_IsNumber(item)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    *value = item->valueint;
+
+    /* Ensure value is within range */
+    if (*value > max) {
+        *value = max;
+    } else if (*value < min) {
+        *value = min;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Receives and parses a JSON request body.
+ *
+ * @param req Pointer to the HTTP request.
+ * @param max_length Largest accepted body length.
+ * @param root Destination of the parsed body, NULL if it is not valid JSON.
+ * Must be freed with cJSON_Delete.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE for an empty or too long
+ * body, ESP_FAIL if the connection failed.
+ */
+static esp_err_t http_recv_json(httpd_req_t *req, size_t max_length,
+                                cJSON **root)
+{
+    if (req->content_len == 0 || req->content_len > max_length) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    char *body = malloc(req->content_len + 1);
+
+    if (body == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Receive the whole body, it may come in several segments */
+    size_t received = 0;
+
+    while (received < req->content_len) {
+        const int length = httpd_req_recv(req, body + received,
+                                          req->content_len - received);
+
+        if (length == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+
+        if (length <= 0) {
+            free(body);
+            return ESP_FAIL;
+        }
+
+        received += length;
     }
+
+    body[received] = '\0';
+
+    *root = cJSON_Parse(body);
+    free(body);
+
+    return ESP_OK;
 }
 
 /**
- * @brief Initializes the Wi-Fi access point (AP) mode with static IP 
- * configuration.
+ * @brief Parses the operations of a scene.
+ *
+ * @param root JSON array of operations.
+ * @param batch Destination of the transitions.
+ * @param count Destination of the number of transitions.
+ *
+ * @return ESP_OK if every operation is valid.
+ */
+static esp_err_t scene_parse(const cJSON *root, transition_request_t *batch,
+                             size_t *count)
+{
+    const cJSON *operation;
+
+    *count = 0;
+
+    if (!cJSON_IsArray(root)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    cJSON_ArrayForEach(operation, root) {
+        int channel;
+        int value;
+        int fade = 0;
+        int easing = TRANSITION_EASING_LINEAR;
+
+        /* Out of range channels are clamped to an invalid one */
+        if (*count == FIRING_MAX_CHANNELS ||
+            json_get_int(operation, "channel", -1, CHANNEL_COUNT,
+                         &channel) != ESP_OK ||
+            channel < 0 || channel >= CHANNEL_COUNT) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        transition_request_t *request = &batch[(*count)++];
+
+        /* Brightness in percentage, or level in full resolution */
+        if (json_get_int(operation, "brightness", 0, 100, &value) == ESP_OK) {
+            value = value * PHASE_LUT_LEVEL_MAX / 100;
+
+        } else if (json_get_int(operation, "level", 0, PHASE_LUT_LEVEL_MAX,
+                                &value) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        json_get_int(operation, "fade", 0, TRANSITION_MAX_DURATION_MS, &fade);
+        json_get_int(operation, "easing", 0, TRANSITION_EASING_MAX - 1,
+                     &easing);
+
+        request->channel = channel;
+        request->target = value;
+        request->duration = fade;
+        request->easing = (transition_easing_t)easing;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Handles HTTP POST requests to the scene endpoint.
+ *
+ * The body is a JSON array of operations, each one an object with a 
+ * "channel", a "brightness" percentage or a full resolution "level", and 
+ * optional "fade" and "easing" members. Either every operation is valid and 
+ * all of them start on the same firing window, or none is applied. Responds 
+ * with the number of operations applied.
+ *
+ * @param req Pointer to the HTTP request.
  * 
- * @return void
+ * @return ESP_OK on success.
  */
-static void wifi_ap_init(void)
+static esp_err_t http_scene_handler(httpd_req_t *req)
 {
     esp_err_t ret;
 
-    /* Initialize the network interface */
-    ret = esp_netif_init();
+    cJSON *root;
+
+    ret = http_recv_json(req, SCENE_MAX_BODY_LENGTH, &root);
+
+    if (ret != ESP_OK) {
+        return (ret == ESP_ERR_INVALID_SIZE)
+                   ? httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                         "Invalid body length")
+                   : ret;
+    }
+
+    transition_request_t batch[FIRING_MAX_CHANNELS];
+    size_t count;
+
+    ret = scene_parse(root, batch, &count);
+    cJSON_Delete(root);
+
+    if (ret != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                   "Invalid scene");
+    }
+
+    transition_start_batch(batch, count, 0);
+
+    /* Keep the WebSocket clients in sync */
+    ws_control_notify();
+
+    char response_buffer[32];
+
+    snprintf(response_buffer, sizeof(response_buffer), "{\"applied\":%u}",
+             (unsigned)count);
+
+    ret = httpd_resp_set_type(req, "application/json");
     ESP_ERROR_CHECK(ret);
 
-    /* Create the default event loop */
-    ret = esp_event_loop_create_default();
+    ret = httpd_resp_send(req, response_buffer, strlen(response_buffer));
     ESP_ERROR_CHECK(ret);
 
-    /* Create the default Wi-Fi AP network interface */
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ret = esp_wifi_init(&cfg);
+    return ESP_OK;
+}
+
+/**
+ * @brief Reboots the dimmer, runs on the timer task.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void restart_callback(void *arg)
+{
+    esp_restart();
+}
+
+/**
+ * @brief Handles HTTP POST requests to the Wi-Fi provisioning endpoint.
+ *
+ * The body is a JSON object with the "ssid" and the "password" of the 
+ * network to join. The credentials are stored and the dimmer reboots into 
+ * station mode once the response is sent. An empty "ssid" removes the 
+ * credentials and reboots into the SoftAP.
+ *
+ * @param req Pointer to the HTTP request.
+ * 
+ * @return ESP_OK on success.
+ */
+static esp_err_t http_wifi_handler(httpd_req_t *req)
+{
+    esp_err_t ret;
+
+    cJSON *root;
+
+    ret = http_recv_json(req, WIFI_MAX_BODY_LENGTH, &root);
+
+    if (ret != ESP_OK) {
+        return (ret == ESP_ERR_INVALID_SIZE)
+                   ? httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                         "Invalid body length")
+                   : ret;
+    }
+
+    const cJSON *ssid = cJSON_GetObjectItemCaseSensitive(root, "ssid");
+    const cJSON *password = cJSON_GetObjectItemCaseSensitive(root, "password");
+
+    ret = ESP_ERR_INVALID_ARG;
+
+    if (cJSON_IsString(ssid)) {
+        ret = network_set_credentials(
+            ssid->valuestring,
+            cJSON_IsString(password) ? password->valuestring : "");
+    }
+
+    cJSON_Delete(root);
+
+    if (ret != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                   "Invalid credentials");
+    }
+
+    ret = httpd_resp_sendstr(req, "OK");
     ESP_ERROR_CHECK(ret);
 
-    wifi_config_t wifi_config = {
-        .ap = {
-            .ssid = WIFI_SSID,
-            .ssid_len = strlen(WIFI_SSID),
-            .channel = WIFI_CHANNEL,
-            .password = WIFI_PASS,
-            .max_connection = MAX_STA_CONN,
-            .authmode = WIFI_AUTH_WPA2_PSK,
-            .pmf_cfg = {
-                .required = false,
-            },
-        },
+    /* Reboot once the response had time to leave */
+    const esp_timer_create_args_t timer_args = {
+        .callback = restart_callback,
+        .name = "restart",
     };
+    esp_timer_handle_t restart_timer;
 
-    /* Initializes the Wi-Fi driver with the default configuration */
-    ret = esp_wifi_set_mode(WIFI_MODE_AP);
+    ret = esp_timer_create(&timer_args, &restart_timer);
     ESP_ERROR_CHECK(ret);
 
-    ret = esp_wifi_set_config(WIFI_IF_AP, &wifi_config);
+    ret = esp_timer_start_once(restart_timer, WIFI_RESTART_DELAY_MS * 1000);
     ESP_ERROR_CHECK(ret);
 
-    /* Set static IP information */
-    esp_netif_ip_info_t ip_info;
+    return ESP_OK;
+}
+
+/**
+ * @brief Handles HTTP GET requests to the power profile endpoint.
+ *
+ * The optional "name" query parameter switches the profile at runtime, and
+ * the response holds the name of the current profile. The interrupt level 
+ * of the dimmer follows the boot profile, only the modem sleep changes.
+ *
+ * @param req Pointer to the HTTP request.
+ * 
+ * @return ESP_OK on success.
+ */
+static esp_err_t http_profile_handler(httpd_req_t *req)
+{
+    esp_err_t ret;
+
+    char buffer[32];
+    char name[16];
 
-    memset(&ip_info, 0, sizeof(esp_netif_ip_info_t));
+    const size_t buffer_length = httpd_req_get_url_query_len(req) + 1;
 
-    ip_info.ip.addr = ipaddr_addr(STATIC_IP_ADDR);
-    ip_info.gw.addr = ipaddr_addr(GATEWAY_ADDR);
-    ip_info.netmask.addr = ipaddr_addr(NETMASK_ADDR);
+    if ((buffer_length > 1) && (buffer_length <= sizeof(buffer)) &&
+        httpd_req_get_url_query_str(req, buffer, buffer_length) == ESP_OK &&
+        httpd_query_key_value(buffer, "name", name, sizeof(name)) == ESP_OK) {
+        const power_profile_t profile = power_profile_from_name(name);
 
-    /* Keep the netif instance for setting IP info */
-    esp_netif_t *ap_netif = esp_netif_create_default_wifi_ap();
+        if (profile == POWER_PROFILE_MAX) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                       "Unknown profile");
+        }
 
-    /* Stop DHCP server before setting static IP info */
-    ret = esp_netif_dhcps_stop(ap_netif);
-    ESP_ERROR_CHECK(ret);
+        if (power_profile_set(profile) != ESP_OK) {
+            return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                       "Failed to apply the profile");
+        }
+    }
 
-    ret = esp_netif_set_ip_info(ap_netif, &ip_info);
-    ESP_ERROR_CHECK(ret);
+    const char *response = power_profile_name(power_profile_get());
 
-    /* Start DHCP server to assign IPs to other connected devices */
-    ret = esp_netif_dhcps_start(ap_netif);
+    ret = httpd_resp_send(req, response, strlen(response));
     ESP_ERROR_CHECK(ret);
 
-    ret = esp_wifi_start();
-    ESP_ERROR_CHECK(ret);
+    return ESP_OK;
+}
+
+/**
+ * @brief Initializes and starts the HTTP server.
+ *
+ * @return void
+ */
+static void http_server_init(void)
+{
+    esp_err_t ret;
+
+    /* Creates an HTTP server handle and default server configuration */
+    httpd_handle_t server = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+    /* Room for all the endpoints, more than the default eight */
+    config.max_uri_handlers = HTTP_MAX_URI_HANDLERS;
+
+    /* Keep the handlers, and the flash writes of the updates, on the
+     * protocol core, away from the control task */
+    config.core_id = 0;
+
+    if (httpd_start(&server, &config) == ESP_OK) {
+        httpd_uri_t root_uri = { 
+            .uri = "/",
+            .method = HTTP_GET,
+            .handler = http_request_handler,
+            .user_ctx = NULL 
+        };
+
+        /* Registers a URI handler for the root ("/") endpoint */
+        ret = httpd_register_uri_handler(server, &root_uri);
+        ESP_ERROR_CHECK(ret);
+
+        httpd_uri_t status_uri = { 
+            .uri = "/status",
+            .method = HTTP_GET,
+            .handler = http_status_handler,
+            .user_ctx = NULL 
+        };
+
+        /* Registers a URI handler for the status endpoint */
+        ret = httpd_register_uri_handler(server, &status_uri);
+        ESP_ERROR_CHECK(ret);
+
+        httpd_uri_t scene_uri = { 
+            .uri = "/scene",
+            .method = HTTP_POST,
+            .handler = http_scene_handler,
+            .user_ctx = NULL 
+        };
+
+        /* Registers a URI handler for the scene endpoint */
+        ret = httpd_register_uri_handler(server, &scene_uri);
+        ESP_ERROR_CHECK(ret);
+
+        httpd_uri_t wifi_uri = { 
+            .uri = "/wifi",
+            .method = HTTP_POST,
+            .handler = http_wifi_handler,
+            .user_ctx = NULL 
+        };
+
+        /* Registers a URI handler for the Wi-Fi provisioning endpoint */
+        ret = httpd_register_uri_handler(server, &wifi_uri);
+        ESP_ERROR_CHECK(ret);
+
+        httpd_uri_t profile_uri = { 
+            .uri = "/profile",
+            .method = HTTP_GET,
+            .handler = http_profile_handler,
+            .user_ctx = NULL 
+        };
+
+        /* Registers a URI handler for the power profile endpoint */
+        ret = httpd_register_uri_handler(server, &profile_uri);
+        ESP_ERROR_CHECK(ret);
+
+        /* Persistent control channel for continuous streaming */
+        ws_control_register(server);
+
+        /* Timing histograms of the firing path */
+        metrics_register(server);
+
+        /* Firmware updates streamed to the inactive slot */
+        ota_register(server);
+
+    } else {
+        ESP_LOGE("HTTP_SERVER", "Failed to start server");
+    }
 }
 
 void app_main(void)
@@ -347,14 +784,51 @@ void app_main(void)
         ESP_ERROR_CHECK(ret);
     }
 
-    /* Initialize WiFi in AP mode */
-    wifi_ap_init();
+    /* Interrupt level of the dimmer ISRs, read when they are allocated */
+    power_profile_init(BOOT_POWER_PROFILE);
 
-    /* Initialize the HTTP server */
-    http_server_init();
+    /* Restore the last brightness before the first edge is serviced */
+    settings_init();
+
+    /* Aggregate the timing samples of the firing path */
+    metrics_init();
+
+    /* Integrate the estimated power of the channels */
+    energy_init();
+
+#if CONFIG_DIMMER_BENCHMARK
+    /* Drive the input before the firing engine loops it back */
+    benchmark_init(INPUT_PIN);
+#endif
 
     /* Run the trigger configuration and calculations in a dedicated core */
     xTaskCreatePinnedToCore(smart_dimmer_control, "smart_dimmer_control",
-                            configMINIMAL_STACK_SIZE, NULL,
+                            CONTROL_TASK_STACK_SIZE, NULL,
                             configMAX_PRIORITIES - 1, &task_handle, 1);
+
+    /* Join the provisioned network, or start the SoftAP, while it locks */
+    network_init();
+
+    /* Modem sleep of the boot profile, once the Wi-Fi driver runs */
+    ret = power_profile_set(power_profile_get());
+    ESP_ERROR_CHECK(ret);
+
+#if CONFIG_DIMMER_ESPNOW
+    /* Receive the group commands on the Wi-Fi channel of the link */
+    espnow_group_init();
+#endif
+
+    /* Initialize the HTTP server */
+    http_server_init();
+
+    /* Initialize the UDP control listener */
+    udp_control_init();
+
+#if CONFIG_DIMMER_BLE
+    /* Advertise the BLE control service next to the Wi-Fi ones */
+    ble_control_init();
+#endif
+
+    /* Confirm a freshly updated image once it runs, or roll it back */
+    ota_init();
 }
@@ -0,0 +1,173 @@
+#include "mains_tracker.h"
+#include "esp_attr.h"
+
+/* Range of plausible periods of the zero-crossing signal in microseconds */
+#define MAINS_TRACKER_MIN_PERIOD_US 5000
+#define MAINS_TRACKER_MAX_PERIOD_US 25000
+
+/* Filter gains, as powers of two, while acquiring and while locked */
+#define MAINS_TRACKER_ACQUIRE_SHIFT 1
+#define MAINS_TRACKER_LOCKED_SHIFT 3
+
+/* Matching intervals needed to lock, and to lock again after a mains loss */
+#define MAINS_TRACKER_LOCK_COUNT 4
+#define MAINS_TRACKER_RELOCK_COUNT 2
+
+/* Mismatching intervals that drop the lock */
+#define MAINS_TRACKER_UNLOCK_COUNT 3
+
+/* Mismatching intervals that restart the estimate while unlocked */
+#define MAINS_TRACKER_RESEED_COUNT 2
+
+void mains_tracker_init(mains_tracker_t *tracker)
+{
+    tracker->period_q8 = 0;
+    tracker->last_edge = 0;
+    tracker->good_count = 0;
+    tracker->bad_count = 0;
+    tracker->is_locked = false;
+    tracker->is_recovering = false;
+}
+
+void IRAM_ATTR mains_tracker_unlock(mains_tracker_t *tracker)
+{
+    tracker->good_count = 0;
+    tracker->bad_count = 0;
+    tracker->is_locked = false;
+}
+
+void IRAM_ATTR mains_tracker_lose(mains_tracker_t *tracker)
+{
+    mains_tracker_unlock(tracker);
+
+    tracker->last_edge = 0;
+    tracker->is_recovering = tracker->period_q8 != 0;
+}
+
+/**
+ * @brief Checks whether an interval spans several periods of the estimate.
+ *
+ * @param interval Interval between edges in microseconds.
+ * @param estimate Estimated period in microseconds.
+ * @param tolerance Tolerance of a single period in microseconds.
+ *
+ * @return true if the interval is explained by missing edges.
+ */
+static bool IRAM_ATTR mains_tracker_is_missed(uint32_t interval,
+                                              uint32_t estimate,
+                                              uint32_t tolerance)
+{
+    const uint32_t cycles = (interval + estimate / 2) / estimate;
+
+    if (cycles < 2 || cycles > MAINS_TRACKER_MAX_MISSED + 1) {
+        return false;
+    }
+
+    const int32_t error = (int32_t)(interval - cycles * estimate);
+
+    return error <= (int32_t)(cycles * tolerance) &&
+           error >= -(int32_t)(cycles * tolerance);
+}
+
+bool IRAM_ATTR mains_tracker_update(mains_tracker_t *tracker,
+                                    uint64_t edge_time)
+{
+    /* First edge, only a reference */
+    if (tracker->last_edge == 0) {
+        tracker->last_edge = edge_time;
+        return true;
+    }
+
+    const uint64_t elapsed = edge_time - tracker->last_edge;
+    const uint32_t interval =
+        (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed;
+    const bool is_plausible = interval >= MAINS_TRACKER_MIN_PERIOD_US &&
+                              interval <= MAINS_TRACKER_MAX_PERIOD_US;
+
+    /* No estimate yet, seed it from the first plausible interval */
+    if (tracker->period_q8 == 0) {
+        if (is_plausible) {
+            tracker->period_q8 = interval << 8;
+        }
+
+        tracker->last_edge = edge_time;
+        return true;
+    }
+
+    const uint32_t estimate = tracker->period_q8 >> 8;
+    const uint32_t tolerance = estimate >> MAINS_TRACKER_TOLERANCE_SHIFT;
+    const int32_t error = (int32_t)(interval - estimate);
+
+    /* Interval agrees with the estimate, filter it in */
+    if (error <= (int32_t)tolerance && error >= -(int32_t)tolerance) {
+        const uint32_t shift = tracker->is_locked ? MAINS_TRACKER_LOCKED_SHIFT
+                                                  : MAINS_TRACKER_ACQUIRE_SHIFT;
+
+        tracker->period_q8 +=
+            (int32_t)((interval << 8) - tracker->period_q8) / (1 << shift);
+
+        tracker->bad_count = 0;
+
+        const uint8_t lock_count = tracker->is_recovering
+                                       ? MAINS_TRACKER_RELOCK_COUNT
+                                       : MAINS_TRACKER_LOCK_COUNT;
+
+        if (!tracker->is_locked && ++tracker->good_count >= lock_count) {
+            tracker->is_locked = true;
+            tracker->is_recovering = false;
+        }
+
+        tracker->last_edge = edge_time;
+        return true;
+    }
+
+    tracker->good_count = 0;
+    tracker->is_recovering = false;
+
+    /* Early edge while locked, a glitch that must not move the reference */
+    if (error < 0 && tracker->is_locked) {
+        if (++tracker->bad_count >= MAINS_TRACKER_UNLOCK_COUNT) {
+            mains_tracker_unlock(tracker);
+        }
+
+        return false;
+    }
+
+    /* Late edge explained by missing edges, keep the estimate */
+    if (mains_tracker_is_missed(interval, estimate, tolerance)) {
+        tracker->last_edge = edge_time;
+        return true;
+    }
+
+    /* Genuine edge that disagrees with the estimate */
+    tracker->bad_count++;
+
+    if (tracker->is_locked) {
+        if (tracker->bad_count >= MAINS_TRACKER_UNLOCK_COUNT) {
+            mains_tracker_unlock(tracker);
+        }
+
+    } else if (tracker->bad_count >= MAINS_TRACKER_RESEED_COUNT &&
+               is_plausible) {
+        /* The frequency really changed, restart from this interval */
+        tracker->period_q8 = interval << 8;
+        tracker->bad_count = 0;
+    }
+
+    tracker->last_edge = edge_time;
+    return true;
+}
+
+uint32_t IRAM_ATTR mains_tracker_period(const mains_tracker_t *tracker)
+{
+    return (tracker->period_q8 + 128) >> 8;
+}
+
+uint32_t mains_tracker_frequency(uint32_t period)
+{
+    if (period == 0) {
+        return 0;
+    }
+
+    return (uint32_t)((1000000000ULL + period / 2) / period);
+}
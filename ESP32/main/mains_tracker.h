@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Tolerance of an interval, as a power of two fraction of the estimate */
+#define MAINS_TRACKER_TOLERANCE_SHIFT 5
+
+/* Most consecutive missing edges bridged without losing the estimate */
+#define MAINS_TRACKER_MAX_MISSED 3
+
+/**
+ * @brief Tracker of the zero-crossing signal period.
+ *
+ * Filters the interval between consecutive rising edges with a fixed point
+ * IIR filter and rejects glitches: spurious edges in the middle of a cycle
+ * are dropped without moving the reference edge, and missing edges are
+ * bridged without corrupting the estimate. The tracker reports locked once
+ * enough consecutive intervals agree with the estimate.
+ *
+ * All functions are integer only and safe to call from an ISR.
+ */
+typedef struct {
+    /* Filtered period in 1/256 microseconds */
+    uint32_t period_q8;
+
+    /* Timestamp of the last accepted edge in microseconds */
+    uint64_t last_edge;
+
+    /* Consecutive intervals matching or not matching the estimate */
+    uint8_t good_count;
+    uint8_t bad_count;
+
+    /* Flag set while the estimate is trusted */
+    bool is_locked;
+
+    /* Flag set while re-acquiring with the estimate kept over a mains loss */
+    bool is_recovering;
+} mains_tracker_t;
+
+/**
+ * @brief Initializes the tracker in the unlocked state.
+ *
+ * @param tracker Tracker to initialize.
+ *
+ * @return void
+ */
+void mains_tracker_init(mains_tracker_t *tracker);
+
+/**
+ * @brief Feeds a rising edge timestamp to the tracker.
+ *
+ * @param tracker Tracker to update.
+ * @param edge_time Timestamp of the edge in microseconds.
+ *
+ * @return true if the edge is a genuine zero-crossing, false if it was
+ * rejected as a glitch and must not be used as a timing reference.
+ */
+bool mains_tracker_update(mains_tracker_t *tracker, uint64_t edge_time);
+
+/**
+ * @brief Forgets the lock, keeping the last estimate as the seed.
+ *
+ * The next edges re-acquire the lock starting from the filtered estimate
+ * instead of the first raw interval.
+ *
+ * @param tracker Tracker to update.
+ *
+ * @return void
+ */
+void mains_tracker_unlock(mains_tracker_t *tracker);
+
+/**
+ * @brief Forgets the lock and the reference edge after a mains loss.
+ *
+ * The gap in the edges is not an interval, the next edge only becomes the
+ * new reference. The estimate kept from before the loss is trusted, so the
+ * lock comes back after fewer matching intervals. An interval that does
+ * not match falls back to the normal acquisition.
+ *
+ * @param tracker Tracker to update.
+ *
+ * @return void
+ */
+void mains_tracker_lose(mains_tracker_t *tracker);
+
+/**
+ * @brief Gets the filtered period.
+ *
+ * @param tracker Tracker to read.
+ *
+ * @return Period in microseconds, 0 before the first estimate.
+ */
+uint32_t mains_tracker_period(const mains_tracker_t *tracker);
+
+/**
+ * @brief Converts a period to the frequency of the zero-crossing signal.
+ *
+ * @param period Period in microseconds.
+ *
+ * @return Frequency in millihertz, 0 for an unknown period.
+ */
+uint32_t mains_tracker_frequency(uint32_t period);
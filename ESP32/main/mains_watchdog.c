@@ -0,0 +1,107 @@
+#include "mains_watchdog.h"
+
+#if CONFIG_DIMMER_MAINS_WATCHDOG
+#include "driver/gptimer.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "power_profile.h"
+
+/* Resolution of the watchdog timer, one tick per microsecond */
+#define MAINS_WATCHDOG_RESOLUTION_HZ 1000000
+
+/* Change of the timeout, as a power of two fraction, that moves the alarm */
+#define MAINS_WATCHDOG_UPDATE_SHIFT 4
+
+/* Checks of the driver calls made from the ISR, compiled out in release
+ * builds like the ones of the firing path */
+#if CONFIG_DIMMER_FIRING_CHECKS
+#define MAINS_WATCHDOG_CHECK(x) ESP_ERROR_CHECK(x)
+#else
+#define MAINS_WATCHDOG_CHECK(x) ((void)(x))
+#endif
+
+/* Hardware timer counting from the last feed */
+static gptimer_handle_t watchdog_timer;
+
+/* Function called on every timeout */
+static mains_watchdog_callback_t timeout_callback;
+
+/* Timeout programmed in the alarm, 0 before the first feed */
+static uint32_t alarm_timeout = 0;
+
+/**
+ * @brief Callback of the timer alarm, runs in the ISR.
+ *
+ * The alarm reloads the counter, so it keeps firing every timeout until
+ * the edges come back.
+ *
+ * @param timer Timer that raised the alarm.
+ * @param edata Counter value of the alarm.
+ * @param user_data Not used in this implementation.
+ *
+ * @return true if a higher priority task was woken up.
+ */
+static bool IRAM_ATTR mains_watchdog_isr(gptimer_handle_t timer,
+                                         const gptimer_alarm_event_data_t *edata,
+                                         void *user_data)
+{
+    return timeout_callback();
+}
+
+void mains_watchdog_init(mains_watchdog_callback_t callback)
+{
+    esp_err_t ret;
+
+    timeout_callback = callback;
+
+    const gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = MAINS_WATCHDOG_RESOLUTION_HZ,
+        .intr_priority = power_profile_intr_priority(),
+    };
+
+    ret = gptimer_new_timer(&timer_config, &watchdog_timer);
+    ESP_ERROR_CHECK(ret);
+
+    const gptimer_event_callbacks_t callbacks = {
+        .on_alarm = mains_watchdog_isr,
+    };
+
+    ret = gptimer_register_event_callbacks(watchdog_timer, &callbacks, NULL);
+    ESP_ERROR_CHECK(ret);
+
+    ret = gptimer_enable(watchdog_timer);
+    ESP_ERROR_CHECK(ret);
+
+    /* Counts without an alarm until the period is known */
+    ret = gptimer_start(watchdog_timer);
+    ESP_ERROR_CHECK(ret);
+}
+
+void IRAM_ATTR mains_watchdog_feed(uint32_t timeout)
+{
+    esp_err_t ret;
+
+    ret = gptimer_set_raw_count(watchdog_timer, 0);
+    MAINS_WATCHDOG_CHECK(ret);
+
+    const uint32_t change = (timeout > alarm_timeout) ? timeout - alarm_timeout
+                                                      : alarm_timeout - timeout;
+
+    if (change <= (alarm_timeout >> MAINS_WATCHDOG_UPDATE_SHIFT)) {
+        return;
+    }
+
+    const gptimer_alarm_config_t alarm_config = {
+        .alarm_count = timeout,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+
+    ret = gptimer_set_alarm_action(watchdog_timer, &alarm_config);
+    MAINS_WATCHDOG_CHECK(ret);
+
+    alarm_timeout = timeout;
+}
+#endif
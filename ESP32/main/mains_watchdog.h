@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+/**
+ * @brief Callback called from the timer ISR when the edges stop.
+ *
+ * @return true if a higher priority task was woken up.
+ */
+typedef bool (*mains_watchdog_callback_t)(void);
+
+#if CONFIG_DIMMER_MAINS_WATCHDOG
+/**
+ * @brief Initializes the watchdog of the zero-crossing edges.
+ *
+ * A hardware timer counts from the last feed and calls the callback every
+ * time the timeout elapses without another feed, so a mains loss is caught
+ * within the timeout whatever the state of the tasks. The timer ISR is
+ * allocated on the calling core, at the level of the boot power profile,
+ * and stays idle until the first feed.
+ *
+ * @param callback Function called on every timeout, from the ISR.
+ *
+ * @return void
+ */
+void mains_watchdog_init(mains_watchdog_callback_t callback);
+
+/**
+ * @brief Restarts the timeout, called on every genuine edge.
+ *
+ * Safe to call from an ISR. The alarm is only reprogrammed when the timeout
+ * moves by more than a sixteenth, so a locked period costs a single counter
+ * write.
+ *
+ * @param timeout Time without edges before the callback in microseconds.
+ *
+ * @return void
+ */
+void mains_watchdog_feed(uint32_t timeout);
+#else
+static inline void mains_watchdog_init(mains_watchdog_callback_t callback)
+{
+}
+
+static inline void mains_watchdog_feed(uint32_t timeout)
+{
+}
+#endif
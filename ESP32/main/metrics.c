@@ -0,0 +1,560 @@
+#include "metrics.h"
+
+#if CONFIG_DIMMER_METRICS
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "energy.h"
+
+/* Samples buffered per core, a power of two */
+#define METRICS_RING_SIZE 512
+
+/* Samples copied out of a ring at once by the aggregation */
+#define METRICS_CHUNK_SIZE 32
+
+/* Interval between the aggregations in microseconds */
+#define METRICS_DRAIN_INTERVAL_US 100000
+
+/* Rolling window, made of slots of 10 seconds */
+#define METRICS_SLOT_COUNT 6
+#define METRICS_SLOT_US 10000000
+
+/* Exact buckets below 16 us, then 4 buckets per power of two to 64 ms */
+#define METRICS_LINEAR_BUCKETS 16
+#define METRICS_BUCKETS_PER_OCTAVE 4
+#define METRICS_BUCKETS 64
+
+/* Layout of a ring word, the kind in the top bits and the value below */
+#define METRICS_KIND_SHIFT 28
+#define METRICS_VALUE_MASK 0x0FFFFFFF
+
+/* Tag used in the log messages */
+static const char *TAG = "METRICS";
+
+/* Names of the samples and of the counters, as used by the HTTP API */
+static const char *sample_names[METRICS_SAMPLE_MAX] = {
+    [METRICS_ISR_LATENCY] = "isr_latency",
+    [METRICS_TRIGGER_MARGIN] = "trigger_margin",
+    [METRICS_PERIOD_ERROR] = "period_error",
+    [METRICS_ISR_CYCLES] = "isr_cycles",
+    [METRICS_TASK_WAKEUP] = "task_wakeup",
+    [METRICS_HTTP_HANDLER] = "http_handler",
+};
+
+static const char *counter_names[METRICS_COUNTER_MAX] = {
+    [METRICS_MISSED] = "missed",
+    [METRICS_SKIPPED] = "skipped",
+    [METRICS_GLITCHES] = "glitches",
+    [METRICS_OUTLIERS] = "outliers",
+    [METRICS_UNLOCKS] = "unlocks",
+    [METRICS_MAINS_LOSSES] = "mains_losses",
+};
+
+/**
+ * @brief Ring buffer of a core.
+ *
+ * The producers are the ISRs and tasks of the core, which push with the
+ * local interrupts masked for a few instructions, so they never interleave
+ * and no lock is shared across the cores. The aggregation is the only
+ * consumer.
+ */
+typedef struct {
+    uint32_t words[METRICS_RING_SIZE];
+
+    /* Words pushed since boot, published after the word is written */
+    atomic_uint head;
+
+    /* Words consumed since boot, owned by the aggregation */
+    uint32_t tail;
+} metrics_ring_t;
+
+/**
+ * @brief Histogram of a sample over a slot of the rolling window.
+ */
+typedef struct {
+    uint32_t buckets[METRICS_BUCKETS];
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+} metrics_histogram_t;
+
+static DRAM_ATTR metrics_ring_t rings[portNUM_PROCESSORS];
+
+/* Histograms of every slot, the current one is being filled */
+static metrics_histogram_t slots[METRICS_SLOT_COUNT][METRICS_SAMPLE_MAX];
+static size_t current_slot = 0;
+static int64_t slot_start = 0;
+
+/* Counters since boot or the last reset */
+static DRAM_ATTR atomic_uint counters[METRICS_COUNTER_MAX];
+
+/* Samples lost because a ring was full */
+static uint32_t dropped = 0;
+
+/* Guards the slots against the HTTP handler */
+static SemaphoreHandle_t slots_mutex;
+
+/* Timer moving the samples from the rings to the slots */
+static esp_timer_handle_t drain_timer;
+
+/**
+ * @brief Gets the bucket of a value.
+ *
+ * @param value Value in microseconds.
+ *
+ * @return Index of the bucket.
+ */
+static size_t metrics_bucket(uint32_t value)
+{
+    if (value < METRICS_LINEAR_BUCKETS) {
+        return value;
+    }
+
+    const uint32_t octave = 31 - __builtin_clz(value);
+    const size_t bucket =
+        METRICS_LINEAR_BUCKETS + (octave - 4) * METRICS_BUCKETS_PER_OCTAVE +
+        ((value >> (octave - 2)) & (METRICS_BUCKETS_PER_OCTAVE - 1));
+
+    return (bucket < METRICS_BUCKETS) ? bucket : METRICS_BUCKETS - 1;
+}
+
+/**
+ * @brief Gets the largest value of a bucket.
+ *
+ * @param bucket Index of the bucket.
+ *
+ * @return Value in microseconds.
+ */
+static uint32_t metrics_bucket_upper(size_t bucket)
+{
+    if (bucket < METRICS_LINEAR_BUCKETS) {
+        return bucket;
+    }
+
+    const size_t index = bucket - METRICS_LINEAR_BUCKETS;
+    const uint32_t octave = 4 + index / METRICS_BUCKETS_PER_OCTAVE;
+    const uint32_t step = 1UL << (octave - 2);
+
+    return (METRICS_BUCKETS_PER_OCTAVE + index % METRICS_BUCKETS_PER_OCTAVE) *
+               step +
+           step - 1;
+}
+
+/**
+ * @brief Adds a sample to the current slot.
+ *
+ * @param word Ring word of the sample.
+ *
+ * @return void
+ */
+static void metrics_add(uint32_t word)
+{
+    const uint32_t kind = word >> METRICS_KIND_SHIFT;
+
+    if (kind >= METRICS_SAMPLE_MAX) {
+        return;
+    }
+
+    /* Sign extend the value from the ring word */
+    const int32_t value =
+        (int32_t)(word << (32 - METRICS_KIND_SHIFT)) >> (32 - METRICS_KIND_SHIFT);
+
+    metrics_histogram_t *histogram = &slots[current_slot][kind];
+
+    /* Errors are binned by magnitude, late triggers in the first bucket */
+    uint32_t magnitude;
+
+    if (kind == METRICS_PERIOD_ERROR) {
+        magnitude = (value < 0) ? -value : value;
+    } else {
+        magnitude = (value < 0) ? 0 : value;
+    }
+
+    histogram->buckets[metrics_bucket(magnitude)]++;
+
+    if (histogram->count == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+
+    if (histogram->count == 0 || value > histogram->max) {
+        histogram->max = value;
+    }
+
+    histogram->count++;
+}
+
+/**
+ * @brief Moves the samples of a ring to the current slot.
+ *
+ * Copies the words in chunks, and drops the ones the producers overwrote
+ * in the meantime.
+ *
+ * @param ring Ring to drain.
+ *
+ * @return void
+ */
+static void metrics_drain_ring(metrics_ring_t *ring)
+{
+    uint32_t chunk[METRICS_CHUNK_SIZE];
+
+    for (;;) {
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        if (head - ring->tail > METRICS_RING_SIZE) {
+            dropped += head - ring->tail - METRICS_RING_SIZE;
+            ring->tail = head - METRICS_RING_SIZE;
+        }
+
+        uint32_t length = head - ring->tail;
+
+        if (length == 0) {
+            return;
+        }
+
+        if (length > METRICS_CHUNK_SIZE) {
+            length = METRICS_CHUNK_SIZE;
+        }
+
+        for (uint32_t i = 0; i < length; i++) {
+            chunk[i] = ring->words[(ring->tail + i) & (METRICS_RING_SIZE - 1)];
+        }
+
+        /* Words pushed meanwhile may have overwritten the oldest copied */
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        uint32_t first = 0;
+
+        if (head - ring->tail > METRICS_RING_SIZE) {
+            first = head - ring->tail - METRICS_RING_SIZE;
+
+            if (first > length) {
+                first = length;
+            }
+
+            dropped += first;
+        }
+
+        for (uint32_t i = first; i < length; i++) {
+            metrics_add(chunk[i]);
+        }
+
+        ring->tail += length;
+    }
+}
+
+/**
+ * @brief Moves the samples to the histograms, runs on the timer task.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void metrics_drain(void *arg)
+{
+    const int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(slots_mutex, portMAX_DELAY);
+
+    /* Start a new slot, forgetting the oldest one */
+    if (now - slot_start >= METRICS_SLOT_US) {
+        current_slot = (current_slot + 1) % METRICS_SLOT_COUNT;
+        memset(slots[current_slot], 0, sizeof(slots[current_slot]));
+        slot_start = now;
+    }
+
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++) {
+        metrics_drain_ring(&rings[core]);
+    }
+
+    xSemaphoreGive(slots_mutex);
+}
+
+/**
+ * @brief Merges the slots of the rolling window of a sample.
+ *
+ * Must be called with the slots mutex taken.
+ *
+ * @param sample Kind of the sample.
+ * @param histogram Destination of the merged histogram.
+ *
+ * @return void
+ */
+static void metrics_merge(metrics_sample_t sample,
+                          metrics_histogram_t *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+
+    for (size_t slot = 0; slot < METRICS_SLOT_COUNT; slot++) {
+        const metrics_histogram_t *source = &slots[slot][sample];
+
+        if (source->count == 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+            histogram->buckets[i] += source->buckets[i];
+        }
+
+        if (histogram->count == 0 || source->min < histogram->min) {
+            histogram->min = source->min;
+        }
+
+        if (histogram->count == 0 || source->max > histogram->max) {
+            histogram->max = source->max;
+        }
+
+        histogram->count += source->count;
+    }
+}
+
+/**
+ * @brief Gets a percentile of a histogram.
+ *
+ * @param histogram Histogram to read.
+ * @param percent Percentile, from 1 to 100.
+ *
+ * @return Largest value of the bucket holding the percentile.
+ */
+static uint32_t metrics_percentile(const metrics_histogram_t *histogram,
+                                   uint32_t percent)
+{
+    const uint32_t rank =
+        (uint32_t)(((uint64_t)histogram->count * percent + 99) / 100);
+    uint32_t total = 0;
+
+    for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+        total += histogram->buckets[i];
+
+        if (total >= rank) {
+            return metrics_bucket_upper(i);
+        }
+    }
+
+    return metrics_bucket_upper(METRICS_BUCKETS - 1);
+}
+
+/**
+ * @brief Gets the statistics of a merged histogram.
+ *
+ * @param histogram Histogram to read.
+ * @param summary Destination of the statistics.
+ *
+ * @return void
+ */
+static void metrics_summarize(const metrics_histogram_t *histogram,
+                              metrics_summary_t *summary)
+{
+    summary->count = histogram->count;
+    summary->min = histogram->min;
+    summary->max = histogram->max;
+    summary->p50 = metrics_percentile(histogram, 50);
+    summary->p99 = metrics_percentile(histogram, 99);
+}
+
+/**
+ * @brief Handles HTTP GET requests to the metrics endpoint.
+ *
+ * The histograms list the non empty buckets as pairs of the largest value
+ * of the bucket and the count.
+ *
+ * @param req Pointer to the HTTP request.
+ *
+ * @return ESP_OK on success.
+ */
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    esp_err_t ret;
+
+    char buffer[160];
+    metrics_histogram_t histogram;
+    metrics_summary_t summary;
+
+    ret = httpd_resp_set_type(req, "application/json");
+    ESP_ERROR_CHECK(ret);
+
+    snprintf(buffer, sizeof(buffer), "{\"window\":%d",
+             METRICS_SLOT_COUNT * METRICS_SLOT_US / 1000000);
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    for (int sample = 0; sample < METRICS_SAMPLE_MAX; sample++) {
+        xSemaphoreTake(slots_mutex, portMAX_DELAY);
+        metrics_merge((metrics_sample_t)sample, &histogram);
+        xSemaphoreGive(slots_mutex);
+
+        metrics_summarize(&histogram, &summary);
+
+        snprintf(buffer, sizeof(buffer),
+                 ",\"%s\":{\"count\":%lu,\"min\":%ld,\"max\":%ld,\"p50\":%lu,"
+                 "\"p99\":%lu,\"histogram\":[",
+                 sample_names[sample], (unsigned long)summary.count,
+                 (long)summary.min, (long)summary.max,
+                 (unsigned long)summary.p50, (unsigned long)summary.p99);
+        httpd_resp_sendstr_chunk(req, buffer);
+
+        bool is_first = true;
+
+        for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+            if (histogram.buckets[i] == 0) {
+                continue;
+            }
+
+            snprintf(buffer, sizeof(buffer), "%s[%lu,%lu]",
+                     is_first ? "" : ",",
+                     (unsigned long)metrics_bucket_upper(i),
+                     (unsigned long)histogram.buckets[i]);
+            httpd_resp_sendstr_chunk(req, buffer);
+
+            is_first = false;
+        }
+
+        httpd_resp_sendstr_chunk(req, "]}");
+    }
+
+    httpd_resp_sendstr_chunk(req, ",\"counters\":{");
+
+    for (int counter = 0; counter < METRICS_COUNTER_MAX; counter++) {
+        snprintf(buffer, sizeof(buffer), "\"%s\":%u,", counter_names[counter],
+                 atomic_load_explicit(&counters[counter],
+                                      memory_order_relaxed));
+        httpd_resp_sendstr_chunk(req, buffer);
+    }
+
+    snprintf(buffer, sizeof(buffer), "\"dropped\":%lu},\"energy\":[",
+             (unsigned long)dropped);
+    httpd_resp_sendstr_chunk(req, buffer);
+
+    /* Power in watts and energy since boot in kWh, 1 mWh is 3.6 J */
+    for (size_t channel = 0; channel < CONFIG_DIMMER_CHANNEL_COUNT;
+         channel++) {
+        const uint32_t power = energy_get_power(channel);
+        const uint64_t energy = energy_get_energy(channel) / 3600;
+
+        snprintf(buffer, sizeof(buffer),
+                 "%s{\"rated\":%u,\"watts\":%lu.%03lu,"
+                 "\"kwh\":%llu.%06llu}",
+                 (channel > 0) ? "," : "", energy_get_rated(channel),
+                 (unsigned long)(power / 1000), (unsigned long)(power % 1000),
+                 (unsigned long long)(energy / 1000000),
+                 (unsigned long long)(energy % 1000000));
+        httpd_resp_sendstr_chunk(req, buffer);
+    }
+
+    httpd_resp_sendstr_chunk(req, "]}");
+
+    /* Empty chunk ends the response */
+    ret = httpd_resp_sendstr_chunk(req, NULL);
+    ESP_ERROR_CHECK(ret);
+
+    return ESP_OK;
+}
+
+void metrics_init(void)
+{
+    esp_err_t ret;
+
+    slots_mutex = xSemaphoreCreateMutex();
+
+    if (slots_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create the mutex");
+        return;
+    }
+
+    slot_start = esp_timer_get_time();
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = metrics_drain,
+        .name = "metrics",
+    };
+
+    ret = esp_timer_create(&timer_args, &drain_timer);
+    ESP_ERROR_CHECK(ret);
+
+    ret = esp_timer_start_periodic(drain_timer, METRICS_DRAIN_INTERVAL_US);
+    ESP_ERROR_CHECK(ret);
+}
+
+void IRAM_ATTR metrics_record(metrics_sample_t sample, int32_t value)
+{
+    const uint32_t word = ((uint32_t)sample << METRICS_KIND_SHIFT) |
+                          ((uint32_t)value & METRICS_VALUE_MASK);
+
+    /* Keep the other producers of this core out for the push */
+    const uint32_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    metrics_ring_t *ring = &rings[xPortGetCoreID()];
+    const uint32_t head =
+        atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    ring->words[head & (METRICS_RING_SIZE - 1)] = word;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+void IRAM_ATTR metrics_count(metrics_counter_t counter)
+{
+    atomic_fetch_add_explicit(&counters[counter], 1, memory_order_relaxed);
+}
+
+void metrics_get_summary(metrics_sample_t sample, metrics_summary_t *summary)
+{
+    metrics_histogram_t histogram;
+
+    xSemaphoreTake(slots_mutex, portMAX_DELAY);
+    metrics_merge(sample, &histogram);
+    xSemaphoreGive(slots_mutex);
+
+    metrics_summarize(&histogram, summary);
+}
+
+uint32_t metrics_get_counter(metrics_counter_t counter)
+{
+    return atomic_load_explicit(&counters[counter], memory_order_relaxed);
+}
+
+void metrics_reset(void)
+{
+    xSemaphoreTake(slots_mutex, portMAX_DELAY);
+
+    /* Discard the samples still waiting in the rings */
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++) {
+        rings[core].tail =
+            atomic_load_explicit(&rings[core].head, memory_order_acquire);
+    }
+
+    memset(slots, 0, sizeof(slots));
+    slot_start = esp_timer_get_time();
+    dropped = 0;
+
+    xSemaphoreGive(slots_mutex);
+
+    for (size_t counter = 0; counter < METRICS_COUNTER_MAX; counter++) {
+        atomic_store_explicit(&counters[counter], 0, memory_order_relaxed);
+    }
+}
+
+void metrics_register(httpd_handle_t server)
+{
+    esp_err_t ret;
+
+    if (slots_mutex == NULL) {
+        return;
+    }
+
+    httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_handler,
+        .user_ctx = NULL,
+    };
+
+    /* Registers a URI handler for the metrics endpoint */
+    ret = httpd_register_uri_handler(server, &metrics_uri);
+    ESP_ERROR_CHECK(ret);
+}
+#endif
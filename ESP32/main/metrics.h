@@ -0,0 +1,179 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_http_server.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief Timing samples recorded by the firing path, in microseconds unless
+ * noted otherwise.
+ */
+typedef enum {
+    /* Delay from the captured edge to the entry of the edge ISR */
+    METRICS_ISR_LATENCY,
+
+    /* Time left before the earliest trigger once scheduled, late if < 0 */
+    METRICS_TRIGGER_MARGIN,
+
+    /* Interval between rising edges minus the tracked period */
+    METRICS_PERIOD_ERROR,
+
+    /* CPU cycles spent in the edge ISR */
+    METRICS_ISR_CYCLES,
+
+    /* Delay from the captured edge to the control task running */
+    METRICS_TASK_WAKEUP,
+
+    /* Time spent in the brightness HTTP handler */
+    METRICS_HTTP_HANDLER,
+
+    METRICS_SAMPLE_MAX,
+} metrics_sample_t;
+
+/**
+ * @brief Events counted by the firing path.
+ */
+typedef enum {
+    /* Windows whose trigger was scheduled after the trigger time */
+    METRICS_MISSED,
+
+    /* Windows not fired while unlocked or after a glitch */
+    METRICS_SKIPPED,
+
+    /* Edges rejected as glitches by the period tracker */
+    METRICS_GLITCHES,
+
+    /* Intervals outside the tolerance of the period tracker */
+    METRICS_OUTLIERS,
+
+    /* Losses of the period tracker lock */
+    METRICS_UNLOCKS,
+
+    /* Silences of the zero-crossing input longer than the bridged edges */
+    METRICS_MAINS_LOSSES,
+
+    METRICS_COUNTER_MAX,
+} metrics_counter_t;
+
+/**
+ * @brief Statistics of a sample over the rolling window.
+ */
+typedef struct {
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+
+    /* Largest value of the buckets of the median and 99th percentile */
+    uint32_t p50;
+    uint32_t p99;
+} metrics_summary_t;
+
+#if CONFIG_DIMMER_METRICS
+/**
+ * @brief Initializes the aggregation of the samples.
+ *
+ * Samples are pushed to a ring buffer of the calling core, without locks,
+ * and a timer on the protocol core moves them to rolling histograms over
+ * the last minute.
+ *
+ * @return void
+ */
+void metrics_init(void);
+
+/**
+ * @brief Records a timing sample.
+ *
+ * Safe to call from an ISR and from any core, runs in constant time.
+ *
+ * @param sample Kind of the sample.
+ * @param value Value in microseconds.
+ *
+ * @return void
+ */
+void metrics_record(metrics_sample_t sample, int32_t value);
+
+/**
+ * @brief Counts an event.
+ *
+ * Safe to call from an ISR and from any core.
+ *
+ * @param counter Event to count.
+ *
+ * @return void
+ */
+void metrics_count(metrics_counter_t counter);
+
+/**
+ * @brief Gets the statistics of a sample over the rolling window.
+ *
+ * Includes the samples recorded up to the last aggregation, at most 100 ms
+ * ago.
+ *
+ * @param sample Kind of the sample.
+ * @param summary Destination of the statistics.
+ *
+ * @return void
+ */
+void metrics_get_summary(metrics_sample_t sample, metrics_summary_t *summary);
+
+/**
+ * @brief Gets a counter.
+ *
+ * @param counter Event counted.
+ *
+ * @return Events since boot or since the last reset.
+ */
+uint32_t metrics_get_counter(metrics_counter_t counter);
+
+/**
+ * @brief Forgets all the samples and clears the counters.
+ *
+ * @return void
+ */
+void metrics_reset(void);
+
+/**
+ * @brief Registers the metrics endpoint on the HTTP server.
+ *
+ * GET /metrics responds with a JSON object holding the count, minimum,
+ * maximum, median and 99th percentile and the histogram of every sample
+ * over the last minute, the counters since boot or the last reset, and the
+ * rated power, estimated power and energy since boot of every channel.
+ *
+ * @param server Running HTTP server.
+ *
+ * @return void
+ */
+void metrics_register(httpd_handle_t server);
+#else
+static inline void metrics_init(void)
+{
+}
+
+static inline void metrics_record(metrics_sample_t sample, int32_t value)
+{
+}
+
+static inline void metrics_count(metrics_counter_t counter)
+{
+}
+
+static inline void metrics_get_summary(metrics_sample_t sample,
+                                       metrics_summary_t *summary)
+{
+    *summary = (metrics_summary_t){ 0 };
+}
+
+static inline uint32_t metrics_get_counter(metrics_counter_t counter)
+{
+    return 0;
+}
+
+static inline void metrics_reset(void)
+{
+}
+
+static inline void metrics_register(httpd_handle_t server)
+{
+}
+#endif
@@ -0,0 +1,382 @@
+#include "network.h"
+#include <string.h>
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "lwip/sockets.h"
+#include "mdns.h"
+#include "nvs.h"
+
+/* SoftAP config, used when no network is provisioned */
+#define WIFI_SSID "DIMMER"
+#define WIFI_PASS "password"
+#define WIFI_CHANNEL 1
+#define MAX_STA_CONN 1
+
+/* IP config for the WiFi AP */
+#define STATIC_IP_ADDR "192.168.1.1"
+#define GATEWAY_ADDR "192.168.1.1"
+#define NETMASK_ADDR "255.255.255.0"
+
+/* NVS namespace and keys of the network credentials */
+#define NETWORK_NVS_NAMESPACE "wifi"
+#define NETWORK_NVS_SSID "ssid"
+#define NETWORK_NVS_PASSWORD "pass"
+
+/* Failed attempts to join the network before falling back to the SoftAP */
+#define NETWORK_MAX_RETRIES 5
+
+/* Interval between the attempts to join once fallen back in microseconds */
+#define NETWORK_FALLBACK_RETRY_US (5 * 60 * 1000000LL)
+
+/* Prefix of the mDNS host name, followed by the end of the MAC address */
+#define NETWORK_HOSTNAME_PREFIX "dimmer"
+
+/* Beacons slept through in the low power profile */
+#define NETWORK_LISTEN_INTERVAL 3
+
+/* Tag used in the log messages */
+static const char *TAG = "NETWORK";
+
+/* Flag set in station mode */
+static bool is_station = false;
+
+/* Flag set once the station got an address, so it never falls back */
+static bool is_connected_once = false;
+
+/* Consecutive failed attempts to join the network */
+static int retry_count = 0;
+
+/* Flag set once the SoftAP was opened after failing to join */
+static bool is_fallback = false;
+
+/* Timer of the next attempt to join once fallen back */
+static esp_timer_handle_t retry_timer;
+
+/* mDNS host name */
+static char hostname[sizeof(NETWORK_HOSTNAME_PREFIX) + 7];
+
+/**
+ * @brief Reads the provisioned credentials.
+ *
+ * The fields of the driver hold a full length SSID or password without
+ * the terminator, so both are read with room for it and copied without.
+ *
+ * @param config Destination of the credentials.
+ *
+ * @return true if a network is provisioned.
+ */
+static bool network_read_credentials(wifi_sta_config_t *config)
+{
+    nvs_handle_t handle;
+
+    if (nvs_open(NETWORK_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+
+    char ssid[NETWORK_SSID_MAX_LENGTH + 1];
+    char password[NETWORK_PASSWORD_MAX_LENGTH + 1];
+    size_t ssid_length = sizeof(ssid);
+    size_t password_length = sizeof(password);
+
+    const bool is_provisioned =
+        nvs_get_str(handle, NETWORK_NVS_SSID, ssid, &ssid_length) == ESP_OK &&
+        nvs_get_str(handle, NETWORK_NVS_PASSWORD, password,
+                    &password_length) == ESP_OK &&
+        ssid_length > 1;
+
+    nvs_close(handle);
+
+    if (is_provisioned) {
+        /* The lengths count the terminator, left out of full fields */
+        memcpy(config->ssid, ssid, ssid_length - 1);
+        memcpy(config->password, password, password_length - 1);
+    }
+
+    return is_provisioned;
+}
+
+esp_err_t network_set_credentials(const char *ssid, const char *password)
+{
+    esp_err_t ret;
+    nvs_handle_t handle;
+
+    if (strlen(ssid) > NETWORK_SSID_MAX_LENGTH ||
+        strlen(password) > NETWORK_PASSWORD_MAX_LENGTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ret = nvs_open(NETWORK_NVS_NAMESPACE, NVS_READWRITE, &handle);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (ssid[0] == '\0') {
+        ret = nvs_erase_all(handle);
+    } else {
+        ret = nvs_set_str(handle, NETWORK_NVS_SSID, ssid);
+
+        if (ret == ESP_OK) {
+            ret = nvs_set_str(handle, NETWORK_NVS_PASSWORD, password);
+        }
+    }
+
+    if (ret == ESP_OK) {
+        ret = nvs_commit(handle);
+    }
+
+    nvs_close(handle);
+
+    return ret;
+}
+
+bool network_is_station(void)
+{
+    return is_station;
+}
+
+/**
+ * @brief Starts the SoftAP with its static IP configuration.
+ *
+ * @return ESP_OK on success.
+ */
+static esp_err_t network_start_ap(void)
+{
+    esp_err_t ret;
+
+    wifi_config_t wifi_config = {
+        .ap = {
+            .ssid = WIFI_SSID,
+            .ssid_len = strlen(WIFI_SSID),
+            .channel = WIFI_CHANNEL,
+            .password = WIFI_PASS,
+            .max_connection = MAX_STA_CONN,
+            .authmode = WIFI_AUTH_WPA2_PSK,
+            .pmf_cfg = {
+                .required = false,
+            },
+        },
+    };
+
+    ret = esp_wifi_set_config(WIFI_IF_AP, &wifi_config);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    /* Set static IP information */
+    esp_netif_ip_info_t ip_info;
+
+    memset(&ip_info, 0, sizeof(esp_netif_ip_info_t));
+
+    ip_info.ip.addr = ipaddr_addr(STATIC_IP_ADDR);
+    ip_info.gw.addr = ipaddr_addr(GATEWAY_ADDR);
+    ip_info.netmask.addr = ipaddr_addr(NETMASK_ADDR);
+
+    /* Keep the netif instance for setting IP info */
+    esp_netif_t *ap_netif = esp_netif_create_default_wifi_ap();
+
+    /* Stop DHCP server before setting static IP info */
+    ret = esp_netif_dhcps_stop(ap_netif);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = esp_netif_set_ip_info(ap_netif, &ip_info);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    /* Start DHCP server to assign IPs to other connected devices */
+    return esp_netif_dhcps_start(ap_netif);
+}
+
+/**
+ * @brief Attempts to join the network again, runs on the timer task.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void network_retry(void *arg)
+{
+    esp_wifi_connect();
+}
+
+/**
+ * @brief Handles the Wi-Fi and IP events of the station.
+ *
+ * @param arg Not used in this implementation.
+ * @param base Event base.
+ * @param id Event identifier.
+ * @param data Event data.
+ *
+ * @return void
+ */
+static void network_event_handler(void *arg, esp_event_base_t base,
+                                  int32_t id, void *data)
+{
+    if (base == WIFI_EVENT && id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+        /* Every attempt scans away from the channel of the SoftAP, so
+         * once fallen back the network is only tried now and then */
+        if (is_fallback) {
+            esp_timer_start_once(retry_timer, NETWORK_FALLBACK_RETRY_US);
+            return;
+        }
+
+        /* Never joined since boot, open the SoftAP to reprovision */
+        if (!is_connected_once && ++retry_count == NETWORK_MAX_RETRIES) {
+            ESP_LOGW(TAG, "Failed to join the network, starting the SoftAP");
+
+            is_fallback = true;
+
+            esp_err_t ret = esp_wifi_set_mode(WIFI_MODE_APSTA);
+
+            if (ret == ESP_OK) {
+                ret = network_start_ap();
+            }
+
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to start the SoftAP: %s",
+                         esp_err_to_name(ret));
+            }
+
+            esp_timer_start_once(retry_timer, NETWORK_FALLBACK_RETRY_US);
+            return;
+        }
+
+        esp_wifi_connect();
+
+    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        const ip_event_got_ip_t *event = data;
+
+        ESP_LOGI(TAG, "Joined the network as " IPSTR,
+                 IP2STR(&event->ip_info.ip));
+
+        is_connected_once = true;
+        is_fallback = false;
+        retry_count = 0;
+    }
+}
+
+/**
+ * @brief Advertises the dimmer and its services over mDNS.
+ *
+ * @return void
+ */
+static void network_mdns_init(void)
+{
+    esp_err_t ret;
+
+    ret = mdns_init();
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start mDNS");
+        return;
+    }
+
+    ret = mdns_hostname_set(hostname);
+    ESP_ERROR_CHECK(ret);
+
+    ret = mdns_instance_name_set("Smart Dimmer");
+    ESP_ERROR_CHECK(ret);
+
+    ret = mdns_service_add(NULL, "_http", "_tcp", 80, NULL, 0);
+    ESP_ERROR_CHECK(ret);
+
+    ret = mdns_service_add(NULL, "_dimmer", "_udp", CONFIG_DIMMER_UDP_PORT,
+                           NULL, 0);
+    ESP_ERROR_CHECK(ret);
+}
+
+void network_init(void)
+{
+    esp_err_t ret;
+
+    /* Initialize the network interface */
+    ret = esp_netif_init();
+    ESP_ERROR_CHECK(ret);
+
+    /* Create the default event loop */
+    ret = esp_event_loop_create_default();
+    ESP_ERROR_CHECK(ret);
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ret = esp_wifi_init(&cfg);
+    ESP_ERROR_CHECK(ret);
+
+    /* Host name from the end of the MAC address, unique on the network */
+    uint8_t mac[6];
+
+    ret = esp_wifi_get_mac(WIFI_IF_STA, mac);
+    ESP_ERROR_CHECK(ret);
+
+    snprintf(hostname, sizeof(hostname), NETWORK_HOSTNAME_PREFIX
+             "-%02x%02x%02x", mac[3], mac[4], mac[5]);
+
+    wifi_config_t wifi_config = { 0 };
+
+    is_station = network_read_credentials(&wifi_config.sta);
+
+    if (is_station) {
+        esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
+
+        ret = esp_netif_set_hostname(sta_netif, hostname);
+        ESP_ERROR_CHECK(ret);
+
+        const esp_timer_create_args_t timer_args = {
+            .callback = network_retry,
+            .name = "network_retry",
+        };
+
+        ret = esp_timer_create(&timer_args, &retry_timer);
+        ESP_ERROR_CHECK(ret);
+
+        ret = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                         network_event_handler, NULL);
+        ESP_ERROR_CHECK(ret);
+
+        ret = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                         network_event_handler, NULL);
+        ESP_ERROR_CHECK(ret);
+
+        ret = esp_wifi_set_mode(WIFI_MODE_STA);
+        ESP_ERROR_CHECK(ret);
+
+        /* Refuse weaker networks, unless the network is open */
+        wifi_config.sta.threshold.authmode =
+            (wifi_config.sta.password[0] != '\0') ? WIFI_AUTH_WPA2_PSK
+                                                   : WIFI_AUTH_OPEN;
+        wifi_config.sta.pmf_cfg.capable = true;
+
+        /* Only used by the maximum modem sleep of the low power profile */
+        wifi_config.sta.listen_interval = NETWORK_LISTEN_INTERVAL;
+
+        ret = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+        ESP_ERROR_CHECK(ret);
+
+        ESP_LOGI(TAG, "Joining %.*s", (int)sizeof(wifi_config.sta.ssid),
+                 (const char *)wifi_config.sta.ssid);
+
+    } else {
+        /* Initializes the Wi-Fi driver in AP mode */
+        ret = esp_wifi_set_mode(WIFI_MODE_AP);
+        ESP_ERROR_CHECK(ret);
+
+        ret = network_start_ap();
+        ESP_ERROR_CHECK(ret);
+    }
+
+    ret = esp_wifi_start();
+    ESP_ERROR_CHECK(ret);
+
+    network_mdns_init();
+}
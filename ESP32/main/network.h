@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+/* Longest SSID and password accepted by the Wi-Fi driver */
+#define NETWORK_SSID_MAX_LENGTH 32
+#define NETWORK_PASSWORD_MAX_LENGTH 64
+
+/**
+ * @brief Brings up the Wi-Fi link and advertises the dimmer over mDNS.
+ *
+ * With credentials provisioned in the NVS the dimmer joins that network as
+ * a station and gets its address from DHCP. Without credentials, or when
+ * the network cannot be joined at boot, it falls back to the SoftAP with
+ * the static address, where new credentials can be provisioned. It then
+ * only tries to join the network again every 5 minutes, as every attempt
+ * scans away from the channel of the SoftAP.
+ *
+ * In both modes the dimmer is advertised over mDNS as dimmer-XXXXXX.local,
+ * XXXXXX being the end of its MAC address, with the HTTP and the UDP
+ * control services, so it can be found without knowing its address.
+ *
+ * The NVS must be initialized before.
+ *
+ * @return void
+ */
+void network_init(void);
+
+/**
+ * @brief Stores the credentials of the network to join.
+ *
+ * Takes effect on the next boot. An empty SSID removes the credentials,
+ * so the dimmer comes back as a SoftAP.
+ *
+ * @param ssid SSID of the network, up to NETWORK_SSID_MAX_LENGTH.
+ * @param password Password, up to NETWORK_PASSWORD_MAX_LENGTH.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t network_set_credentials(const char *ssid, const char *password);
+
+/**
+ * @brief Checks whether the dimmer runs as a station of a network.
+ *
+ * @return true in station mode, false as a SoftAP.
+ */
+bool network_is_station(void);
@@ -0,0 +1,280 @@
+#include "ota.h"
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "dimmer_state.h"
+
+/* Length of the chunks received and written, one flash sector */
+#define OTA_CHUNK_LENGTH 4096
+
+/* Priority of the server task while writing, below the network stack */
+#define OTA_WRITE_PRIORITY (tskIDLE_PRIORITY + 1)
+
+/* Receive timeouts tolerated in a row before giving up */
+#define OTA_MAX_TIMEOUTS 3
+
+/* Time after the response before the reboot in microseconds */
+#define OTA_RESTART_DELAY_US 500000
+
+/* Interval of the checks of a pending image, and the time it gets */
+#define OTA_CHECK_INTERVAL_US 1000000
+#define OTA_CONFIRM_TIMEOUT_US 30000000
+
+/* Tag used in the log messages */
+static const char *TAG = "OTA";
+
+/* Timer checking a pending image */
+static esp_timer_handle_t check_timer;
+
+/* Time the checks of a pending image started in microseconds */
+static int64_t check_start = 0;
+
+/**
+ * @brief Reboots the dimmer, runs on the timer task.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void ota_restart(void *arg)
+{
+    esp_restart();
+}
+
+/**
+ * @brief Confirms or rolls back the pending image, runs on the timer task.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void ota_check(void *arg)
+{
+    esp_err_t ret;
+
+    dimmer_edges_t edges;
+
+    dimmer_state_read_edges(&edges);
+
+    const bool is_expired =
+        esp_timer_get_time() - check_start >= OTA_CONFIRM_TIMEOUT_US;
+
+    /* Locked to the powergrid, or no powergrid to lock to */
+    if (edges.is_locked || (is_expired && edges.rising_time == 0)) {
+        ret = esp_timer_stop(check_timer);
+        ESP_ERROR_CHECK(ret);
+
+        ret = esp_ota_mark_app_valid_cancel_rollback();
+        ESP_ERROR_CHECK(ret);
+
+        ESP_LOGI(TAG, "Image confirmed");
+        return;
+    }
+
+    if (is_expired) {
+        ESP_LOGE(TAG, "No lock to the powergrid, rolling back");
+
+        /* Only returns if there is no image to roll back to */
+        ret = esp_ota_mark_app_invalid_rollback_and_reboot();
+        ESP_LOGE(TAG, "Rollback failed: %s", esp_err_to_name(ret));
+
+        ret = esp_timer_stop(check_timer);
+        ESP_ERROR_CHECK(ret);
+    }
+}
+
+void ota_init(void)
+{
+    esp_err_t ret;
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK ||
+        state != ESP_OTA_IMG_PENDING_VERIFY) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Checking the image of %s", running->label);
+
+    check_start = esp_timer_get_time();
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = ota_check,
+        .name = "ota_check",
+    };
+
+    ret = esp_timer_create(&timer_args, &check_timer);
+    ESP_ERROR_CHECK(ret);
+
+    ret = esp_timer_start_periodic(check_timer, OTA_CHECK_INTERVAL_US);
+    ESP_ERROR_CHECK(ret);
+}
+
+/**
+ * @brief Streams the body of a request to an update handle.
+ *
+ * Runs at a low priority, so the network stack and the other tasks of the
+ * protocol core run between the chunks. Each sector is erased right before
+ * it is written, and on the ESP32 the flash cache of both cores stays off
+ * for the whole erase, tens of milliseconds. Every task stalls meanwhile,
+ * only the IRAM-safe ISRs keep running: the MCPWM edge capture and firing
+ * ISRs and the GPTimer mains watchdog. Every function they reach must be
+ * in IRAM too, or an edge during an erase crashes the dimmer in the middle
+ * of the image.
+ *
+ * @param req Pointer to the HTTP request.
+ * @param handle Update to write.
+ *
+ * @return ESP_OK once the whole body is written.
+ */
+static esp_err_t ota_receive(httpd_req_t *req, esp_ota_handle_t handle)
+{
+    char *chunk = malloc(OTA_CHUNK_LENGTH);
+
+    if (chunk == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    const UBaseType_t priority = uxTaskPriorityGet(NULL);
+
+    vTaskPrioritySet(NULL, OTA_WRITE_PRIORITY);
+
+    esp_err_t ret = ESP_OK;
+    size_t remaining = req->content_len;
+    int timeouts = 0;
+
+    while (remaining > 0) {
+        const size_t wanted =
+            (remaining < OTA_CHUNK_LENGTH) ? remaining : OTA_CHUNK_LENGTH;
+        const int length = httpd_req_recv(req, chunk, wanted);
+
+        if (length == HTTPD_SOCK_ERR_TIMEOUT &&
+            ++timeouts <= OTA_MAX_TIMEOUTS) {
+            continue;
+        }
+
+        if (length <= 0) {
+            ret = ESP_ERR_TIMEOUT;
+            break;
+        }
+
+        timeouts = 0;
+
+        ret = esp_ota_write(handle, chunk, length);
+
+        if (ret != ESP_OK) {
+            break;
+        }
+
+        remaining -= length;
+    }
+
+    vTaskPrioritySet(NULL, priority);
+    free(chunk);
+
+    return ret;
+}
+
+/**
+ * @brief Handles HTTP POST requests to the update endpoint.
+ *
+ * @param req Pointer to the HTTP request.
+ *
+ * @return ESP_OK on success.
+ */
+static esp_err_t ota_handler(httpd_req_t *req)
+{
+    esp_err_t ret;
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+
+    if (partition == NULL) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   "No OTA partition");
+    }
+
+    if (req->content_len == 0 || req->content_len > partition->size) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                   "Invalid image length");
+    }
+
+    ESP_LOGI(TAG, "Writing %u bytes to %s", (unsigned)req->content_len,
+             partition->label);
+
+    esp_ota_handle_t handle;
+
+    /* Erase each sector right before it is written, not all upfront */
+    ret = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+
+    if (ret != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   "Failed to start the update");
+    }
+
+    ret = ota_receive(req, handle);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Update failed: %s", esp_err_to_name(ret));
+        esp_ota_abort(handle);
+
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   "Failed to write the image");
+    }
+
+    /* Checks the image before it can be booted */
+    ret = esp_ota_end(handle);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid image: %s", esp_err_to_name(ret));
+
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                   "Invalid image");
+    }
+
+    ret = esp_ota_set_boot_partition(partition);
+
+    if (ret != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                                   "Failed to select the image");
+    }
+
+    ret = httpd_resp_sendstr(req, "OK");
+    ESP_ERROR_CHECK(ret);
+
+    ESP_LOGI(TAG, "Rebooting into %s", partition->label);
+
+    /* Reboot once the response had time to leave */
+    const esp_timer_create_args_t timer_args = {
+        .callback = ota_restart,
+        .name = "ota_restart",
+    };
+    esp_timer_handle_t restart_timer;
+
+    ret = esp_timer_create(&timer_args, &restart_timer);
+    ESP_ERROR_CHECK(ret);
+
+    ret = esp_timer_start_once(restart_timer, OTA_RESTART_DELAY_US);
+    ESP_ERROR_CHECK(ret);
+
+    return ESP_OK;
+}
+
+void ota_register(httpd_handle_t server)
+{
+    esp_err_t ret;
+
+    const httpd_uri_t ota_uri = {
+        .uri = "/ota",
+        .method = HTTP_POST,
+        .handler = ota_handler,
+        .user_ctx = NULL,
+    };
+
+    ret = httpd_register_uri_handler(server, &ota_uri);
+    ESP_ERROR_CHECK(ret);
+}
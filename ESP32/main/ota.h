@@ -0,0 +1,34 @@
+#pragma once
+
+#include "esp_http_server.h"
+
+/**
+ * @brief Confirms the running image after an update, or rolls it back.
+ *
+ * A freshly updated image boots pending verification. It is marked valid
+ * once the period tracker locks to the powergrid, or after 30 seconds
+ * without any zero-crossing edge, on a bench supply. Edges that never lock
+ * in that time roll back to the previous image and reboot, and so does any
+ * reset before the image is confirmed. Does nothing for a confirmed image.
+ *
+ * Must be called once the HTTP server runs, so a confirmed image can always
+ * be updated again.
+ *
+ * @return void
+ */
+void ota_init(void);
+
+/**
+ * @brief Registers the firmware update endpoint on the HTTP server.
+ *
+ * POST /ota takes the raw application image as the body. It is streamed to
+ * the inactive OTA slot in 4 KB chunks, erased sector by sector, from the
+ * HTTP server task on the protocol core running at a low priority, while
+ * the firing path keeps running from IRAM on the other core. The image is
+ * validated and the dimmer reboots into it once the response is sent.
+ *
+ * @param server Running HTTP server.
+ *
+ * @return void
+ */
+void ota_register(httpd_handle_t server);
@@ -0,0 +1,331 @@
+#include "phase_lut.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+/* Number of channels with their own table */
+#define PHASE_LUT_CHANNEL_COUNT CONFIG_DIMMER_CHANNEL_COUNT
+
+/* Q16 fraction representing a full period */
+#define PHASE_LUT_ONE 65536
+
+/* Bisection steps used to invert the power curve, enough for Q16 */
+#define PHASE_LUT_SOLVER_STEPS 17
+
+/* Steps of the power table over the half-cycle, as a power of two */
+#define PHASE_LUT_POWER_SHIFT 8
+#define PHASE_LUT_POWER_STEPS (1 << PHASE_LUT_POWER_SHIFT)
+
+/**
+ * @brief Curve and conduction window a channel table is built from.
+ */
+typedef struct {
+    phase_lut_curve_t curve;
+    uint16_t min_conduction;
+    uint16_t max_conduction;
+} phase_lut_channel_t;
+
+/* Phase delays of every curve as Q16 fractions of the period */
+static uint16_t curve_tables[PHASE_LUT_CURVE_MAX][PHASE_LUT_LEVEL_MAX + 1];
+
+/* Phase delays of every channel, read by the firing path */
+static DRAM_ATTR uint16_t
+    channel_tables[PHASE_LUT_CHANNEL_COUNT][PHASE_LUT_LEVEL_MAX + 1];
+
+/* Power fractions in Q16 for evenly spaced delays, interpolated */
+static uint32_t power_table[PHASE_LUT_POWER_STEPS + 1];
+
+/* Sources of the channel tables, the whole half-cycle by default */
+static phase_lut_channel_t channels[PHASE_LUT_CHANNEL_COUNT] = {
+    [0 ... PHASE_LUT_CHANNEL_COUNT - 1] = {
+        .curve = PHASE_LUT_CURVE_LINEAR,
+        .min_conduction = 0,
+        .max_conduction = PHASE_LUT_CONDUCTION_MAX,
+    },
+};
+
+/* Flag set while a channel table is rebuilt, by any task */
+static atomic_flag is_building = ATOMIC_FLAG_INIT;
+
+/* Flag set once the tables are built, read by the firing path */
+static volatile bool is_built = false;
+
+/**
+ * @brief Fraction of the full RMS power delivered for a firing angle.
+ *
+ * @param phase Firing angle as a fraction of the half-cycle, from 0 to 1.
+ *
+ * @return Power fraction, from 1 (fired at zero) to 0 (never fired).
+ */
+static double phase_lut_power_fraction(double phase)
+{
+    return 1.0 - phase + sin(2.0 * M_PI * phase) / (2.0 * M_PI);
+}
+
+/**
+ * @brief Finds the firing angle that delivers the given power fraction.
+ *
+ * @param power Power fraction from 0 to 1.
+ *
+ * @return Firing angle as a fraction of the half-cycle.
+ */
+static double phase_lut_phase_for_power(double power)
+{
+    double low = 0.0;
+    double high = 1.0;
+
+    /* The power curve is monotonically decreasing in the firing angle */
+    for (int i = 0; i < PHASE_LUT_SOLVER_STEPS; i++) {
+        const double middle = (low + high) / 2.0;
+
+        if (phase_lut_power_fraction(middle) > power) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    return (low + high) / 2.0;
+}
+
+/**
+ * @brief Relative luminance for a perceived lightness (CIE 1976 L*).
+ *
+ * @param lightness Lightness fraction from 0 to 1.
+ *
+ * @return Relative luminance from 0 to 1.
+ */
+static double phase_lut_cie_luminance(double lightness)
+{
+    const double l_star = lightness * 100.0;
+
+    if (l_star <= 8.0) {
+        return l_star / 903.3;
+    }
+
+    return pow((l_star + 16.0) / 116.0, 3.0);
+}
+
+/**
+ * @brief Fills a table with the phase delays of a curve.
+ *
+ * @param table Table to fill.
+ * @param curve Curve used to calculate the delays.
+ *
+ * @return void
+ */
+static void phase_lut_build(uint16_t *table, phase_lut_curve_t curve)
+{
+    for (int level = 0; level <= PHASE_LUT_LEVEL_MAX; level++) {
+        const double brightness = (double)level / PHASE_LUT_LEVEL_MAX;
+        double phase;
+
+        switch (curve) {
+        case PHASE_LUT_CURVE_POWER:
+            phase = phase_lut_phase_for_power(brightness);
+            break;
+
+        case PHASE_LUT_CURVE_CIE:
+            phase = phase_lut_phase_for_power(
+                phase_lut_cie_luminance(brightness));
+            break;
+
+        case PHASE_LUT_CURVE_LINEAR:
+        default:
+            phase = 1.0 - brightness;
+            break;
+        }
+
+        /* Level zero must always land in the dead zone */
+        uint32_t delay = (uint32_t)lround(phase * PHASE_LUT_ONE);
+
+        if (level == 0 || delay >= PHASE_LUT_ONE) {
+            delay = PHASE_LUT_ONE - 1;
+        }
+
+        table[level] = (uint16_t)delay;
+    }
+}
+
+/**
+ * @brief Fills the table of a channel from its curve and conduction window.
+ *
+ * The conduction angle of the curve, the rest of the half-cycle after the
+ * delay, is scaled into the window. The tables of the curves must be built.
+ *
+ * @param channel Index of the channel.
+ *
+ * @return void
+ */
+static void phase_lut_build_channel(size_t channel)
+{
+    const phase_lut_channel_t *source = &channels[channel];
+    const uint16_t *curve_table = curve_tables[source->curve];
+    uint16_t *table = channel_tables[channel];
+
+    const uint32_t min =
+        (uint32_t)source->min_conduction * PHASE_LUT_ONE /
+        PHASE_LUT_CONDUCTION_MAX;
+    const uint32_t span =
+        (uint32_t)(source->max_conduction - source->min_conduction) *
+        PHASE_LUT_ONE / PHASE_LUT_CONDUCTION_MAX;
+
+    /* Level zero stays in the dead zone */
+    table[0] = curve_table[0];
+
+    for (int level = 1; level <= PHASE_LUT_LEVEL_MAX; level++) {
+        const uint32_t conduction =
+            min + (uint32_t)(((uint64_t)(PHASE_LUT_ONE - curve_table[level]) *
+                              span) >> 16);
+
+        table[level] = (conduction >= PHASE_LUT_ONE)
+                           ? 0
+                           : (uint16_t)(PHASE_LUT_ONE - conduction);
+    }
+}
+
+/**
+ * @brief Applies a change to the source of a channel table.
+ *
+ * Serializes the callers, a channel table is only rebuilt by one task at a
+ * time. Before phase_lut_init() the change is only recorded.
+ *
+ * @param channel Index of the channel.
+ * @param source New curve and conduction window of the channel.
+ *
+ * @return void
+ */
+static void phase_lut_update(size_t channel, const phase_lut_channel_t *source)
+{
+    if (channel >= PHASE_LUT_CHANNEL_COUNT) {
+        return;
+    }
+
+    /* Short, the other task is filling a single table */
+    while (atomic_flag_test_and_set_explicit(&is_building,
+                                             memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+
+    channels[channel] = *source;
+
+    if (is_built) {
+        phase_lut_build_channel(channel);
+    }
+
+    atomic_flag_clear_explicit(&is_building, memory_order_release);
+}
+
+void phase_lut_init(void)
+{
+    if (is_built) {
+        return;
+    }
+
+    for (int curve = 0; curve < PHASE_LUT_CURVE_MAX; curve++) {
+        phase_lut_build(curve_tables[curve], (phase_lut_curve_t)curve);
+    }
+
+    for (int step = 0; step <= PHASE_LUT_POWER_STEPS; step++) {
+        power_table[step] = (uint32_t)lround(
+            phase_lut_power_fraction((double)step / PHASE_LUT_POWER_STEPS) *
+            PHASE_LUT_ONE);
+    }
+
+    while (atomic_flag_test_and_set_explicit(&is_building,
+                                             memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+
+    /* With the curves and windows set before, by the saved settings */
+    for (size_t channel = 0; channel < PHASE_LUT_CHANNEL_COUNT; channel++) {
+        phase_lut_build_channel(channel);
+    }
+
+    is_built = true;
+
+    atomic_flag_clear_explicit(&is_building, memory_order_release);
+}
+
+void phase_lut_set_curve(size_t channel, phase_lut_curve_t curve)
+{
+    if (channel >= PHASE_LUT_CHANNEL_COUNT || curve >= PHASE_LUT_CURVE_MAX) {
+        return;
+    }
+
+    phase_lut_channel_t source = channels[channel];
+
+    source.curve = curve;
+
+    phase_lut_update(channel, &source);
+}
+
+phase_lut_curve_t phase_lut_get_curve(size_t channel)
+{
+    return (channel < PHASE_LUT_CHANNEL_COUNT) ? channels[channel].curve
+                                               : PHASE_LUT_CURVE_LINEAR;
+}
+
+void phase_lut_set_conduction(size_t channel, uint16_t min, uint16_t max)
+{
+    if (channel >= PHASE_LUT_CHANNEL_COUNT) {
+        return;
+    }
+
+    if (max > PHASE_LUT_CONDUCTION_MAX) {
+        max = PHASE_LUT_CONDUCTION_MAX;
+    }
+
+    if (min > max) {
+        min = max;
+    }
+
+    phase_lut_channel_t source = channels[channel];
+
+    source.min_conduction = min;
+    source.max_conduction = max;
+
+    phase_lut_update(channel, &source);
+}
+
+uint32_t IRAM_ATTR phase_lut_delay(size_t channel, uint16_t level,
+                                   uint32_t period)
+{
+    /* Keep the TRIAC off until the tables are available */
+    if (!is_built || channel >= PHASE_LUT_CHANNEL_COUNT) {
+        return period;
+    }
+
+    if (level > PHASE_LUT_LEVEL_MAX) {
+        level = PHASE_LUT_LEVEL_MAX;
+    }
+
+    return (uint32_t)(((uint64_t)channel_tables[channel][level] * period) >>
+                      16);
+}
+
+uint32_t phase_lut_power(size_t channel, uint16_t level, uint32_t rated)
+{
+    if (!is_built || channel >= PHASE_LUT_CHANNEL_COUNT || level == 0) {
+        return 0;
+    }
+
+    if (level > PHASE_LUT_LEVEL_MAX) {
+        level = PHASE_LUT_LEVEL_MAX;
+    }
+
+    /* Interpolate between the two steps around the delay */
+    const uint32_t delay = channel_tables[channel][level];
+    const uint32_t step = delay >> (16 - PHASE_LUT_POWER_SHIFT);
+    const uint32_t weight = delay & ((1 << (16 - PHASE_LUT_POWER_SHIFT)) - 1);
+    const uint32_t fraction =
+        power_table[step] -
+        (((power_table[step] - power_table[step + 1]) * weight) >>
+         (16 - PHASE_LUT_POWER_SHIFT));
+
+    return (uint32_t)(((uint64_t)fraction * rated) >> 16);
+}
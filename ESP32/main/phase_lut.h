@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Brightness resolution, levels go from 0 (off) to PHASE_LUT_LEVEL_MAX */
+#define PHASE_LUT_LEVEL_MAX 1000
+
+/* Conduction angles in thousandths of the half-cycle */
+#define PHASE_LUT_CONDUCTION_MAX 1000
+
+/**
+ * @brief Curves mapping the brightness level to the phase delay.
+ */
+typedef enum {
+    /* Brightness linear in phase angle */
+    PHASE_LUT_CURVE_LINEAR = 0,
+
+    /* Brightness linear in delivered RMS power */
+    PHASE_LUT_CURVE_POWER,
+
+    /* Brightness linear in perceived lightness (CIE 1976) */
+    PHASE_LUT_CURVE_CIE,
+
+    PHASE_LUT_CURVE_MAX,
+} phase_lut_curve_t;
+
+/**
+ * @brief Builds the lookup tables of all the curves and channels.
+ *
+ * The curve tables store the phase delay as a Q16 fraction of the period, so
+ * they do not depend on the powergrid frequency and are built only once.
+ * Every channel has its own table, derived from its curve and its
+ * conduction window, so both come at no cost in the firing path. The
+ * floating point math runs here, never in the firing path. Must be called
+ * before the first trigger.
+ *
+ * @return void
+ */
+void phase_lut_init(void);
+
+/**
+ * @brief Sets the brightness curve of a channel.
+ *
+ * Rebuilds the table of the channel with integer math only. The firing path
+ * may read the table meanwhile, every entry it reads belongs either to the
+ * old or to the new curve.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ * @param curve Curve mapping the level to the delay.
+ *
+ * @return void
+ */
+void phase_lut_set_curve(size_t channel, phase_lut_curve_t curve);
+
+/**
+ * @brief Gets the brightness curve of a channel.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ *
+ * @return Curve mapping the level to the delay.
+ */
+phase_lut_curve_t phase_lut_get_curve(size_t channel);
+
+/**
+ * @brief Sets the conduction window of a channel.
+ *
+ * The levels above zero are spread over the window instead of the whole
+ * half-cycle, so the lowest level still conducts for the minimum angle
+ * and the highest level never fires earlier than the maximum angle allows.
+ * Level zero stays off. Rebuilds the table of the channel like
+ * phase_lut_set_curve().
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ * @param min Minimum conduction angle, up to PHASE_LUT_CONDUCTION_MAX.
+ * @param max Maximum conduction angle, from min to PHASE_LUT_CONDUCTION_MAX.
+ *
+ * @return void
+ */
+void phase_lut_set_conduction(size_t channel, uint16_t min, uint16_t max);
+
+/**
+ * @brief Gets the phase delay of a channel for a brightness level.
+ *
+ * Integer only, one table lookup and one multiplication, safe to call from
+ * an ISR.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ * @param level Brightness level from 0 to PHASE_LUT_LEVEL_MAX.
+ * @param period Powergrid sine period in microseconds.
+ *
+ * @return Delay from the zero-crossing in microseconds.
+ */
+uint32_t phase_lut_delay(size_t channel, uint16_t level, uint32_t period);
+
+/**
+ * @brief Gets the power a channel delivers at a brightness level.
+ *
+ * Estimates the RMS power of a resistive load fired at the delay of the
+ * level, from a table of the power fraction over the firing angle built by
+ * phase_lut_init(). Integer only, but not meant for the firing path.
+ *
+ * @param channel Index of the channel, below CONFIG_DIMMER_CHANNEL_COUNT.
+ * @param level Brightness level from 0 to PHASE_LUT_LEVEL_MAX.
+ * @param rated Power at full conduction, in any unit.
+ *
+ * @return Power in the unit of the rated power.
+ */
+uint32_t phase_lut_power(size_t channel, uint16_t level, uint32_t rated);
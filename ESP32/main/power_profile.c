@@ -0,0 +1,111 @@
+#include "power_profile.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+/* Tag used in the log messages */
+static const char *TAG = "POWER_PROFILE";
+
+/* Settings of a profile */
+typedef struct {
+    const char *name;
+
+    /* Interrupt level of every dimmer ISR, never left to the drivers */
+    int intr_priority;
+
+    /* Modem sleep of the Wi-Fi station */
+    wifi_ps_type_t wifi_ps;
+} power_profile_config_t;
+
+/* Settings of every profile, in enumeration order */
+static const power_profile_config_t profile_configs[POWER_PROFILE_MAX] = {
+    [POWER_PROFILE_LOW_LATENCY] = {
+        .name = "low-latency",
+        .intr_priority = 3,
+        .wifi_ps = WIFI_PS_NONE,
+    },
+    [POWER_PROFILE_BALANCED] = {
+        .name = "balanced",
+        .intr_priority = 2,
+        .wifi_ps = WIFI_PS_MIN_MODEM,
+    },
+    [POWER_PROFILE_LOW_POWER] = {
+        .name = "low-power",
+        .intr_priority = 1,
+        .wifi_ps = WIFI_PS_MAX_MODEM,
+    },
+};
+
+/* Profile selected at boot, owner of the interrupt level */
+static power_profile_t boot_profile = POWER_PROFILE_BALANCED;
+
+/* Profile currently applied to the radio */
+static power_profile_t current_profile = POWER_PROFILE_BALANCED;
+
+void power_profile_init(power_profile_t profile)
+{
+    if (profile >= POWER_PROFILE_MAX) {
+        profile = POWER_PROFILE_BALANCED;
+    }
+
+    boot_profile = profile;
+    current_profile = profile;
+}
+
+esp_err_t power_profile_set(power_profile_t profile)
+{
+    if (profile >= POWER_PROFILE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    wifi_ps_type_t wifi_ps = profile_configs[profile].wifi_ps;
+
+#if CONFIG_BT_ENABLED
+    /* The radio is shared with Bluetooth only with modem sleep enabled */
+    if (wifi_ps == WIFI_PS_NONE) {
+        wifi_ps = WIFI_PS_MIN_MODEM;
+    }
+#endif
+
+    const esp_err_t ret = esp_wifi_set_ps(wifi_ps);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set the modem sleep: %s",
+                 esp_err_to_name(ret));
+        return ret;
+    }
+
+    current_profile = profile;
+
+    ESP_LOGI(TAG, "Profile %s", profile_configs[profile].name);
+
+    return ESP_OK;
+}
+
+power_profile_t power_profile_get(void)
+{
+    return current_profile;
+}
+
+const char *power_profile_name(power_profile_t profile)
+{
+    return (profile < POWER_PROFILE_MAX) ? profile_configs[profile].name
+                                         : NULL;
+}
+
+power_profile_t power_profile_from_name(const char *name)
+{
+    for (int i = 0; i < POWER_PROFILE_MAX; i++) {
+        if (strcmp(name, profile_configs[i].name) == 0) {
+            return (power_profile_t)i;
+        }
+    }
+
+    return POWER_PROFILE_MAX;
+}
+
+int power_profile_intr_priority(void)
+{
+    return profile_configs[boot_profile].intr_priority;
+}
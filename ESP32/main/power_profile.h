@@ -0,0 +1,87 @@
+#pragma once
+
+#include "esp_err.h"
+
+/**
+ * @brief Trade-offs between the firing jitter and the power draw.
+ *
+ * All the profiles keep the firing engine, the edge capture and its ISR on
+ * the application core, and the Wi-Fi, lwIP and esp_timer tasks and the
+ * esp_timer ISR on the protocol core, so the radio never runs on the core
+ * that timestamps the edges. The profiles differ in the interrupt level of
+ * the dimmer ISRs and in the modem sleep of the Wi-Fi station.
+ */
+typedef enum {
+    /* Modem always on, dimmer ISRs at the highest C interrupt level */
+    POWER_PROFILE_LOW_LATENCY,
+
+    /* Modem sleep between beacons, dimmer ISRs at a medium level */
+    POWER_PROFILE_BALANCED,
+
+    /* Modem sleep over several beacons, dimmer ISRs at a low level */
+    POWER_PROFILE_LOW_POWER,
+
+    POWER_PROFILE_MAX,
+} power_profile_t;
+
+/**
+ * @brief Selects the profile used at boot.
+ *
+ * Must be called before the dimmer ISRs are allocated, their interrupt
+ * level is only read once.
+ *
+ * @param profile Profile to use.
+ *
+ * @return void
+ */
+void power_profile_init(power_profile_t profile);
+
+/**
+ * @brief Switches the profile at runtime.
+ *
+ * The modem sleep changes immediately, the interrupt level of the dimmer
+ * ISRs keeps the one of the boot profile until the next boot.
+ *
+ * @param profile Profile to use.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an unknown profile, or
+ * the error of the Wi-Fi driver.
+ */
+esp_err_t power_profile_set(power_profile_t profile);
+
+/**
+ * @brief Gets the current profile.
+ *
+ * @return Current profile.
+ */
+power_profile_t power_profile_get(void);
+
+/**
+ * @brief Gets the name of a profile, as used by the HTTP API.
+ *
+ * @param profile Profile to name.
+ *
+ * @return Name of the profile, NULL for an unknown profile.
+ */
+const char *power_profile_name(power_profile_t profile);
+
+/**
+ * @brief Finds a profile by its name.
+ *
+ * @param name Name of the profile.
+ *
+ * @return Profile with this name, POWER_PROFILE_MAX if there is none.
+ */
+power_profile_t power_profile_from_name(const char *name);
+
+/**
+ * @brief Gets the interrupt level of the dimmer ISRs for the boot profile.
+ *
+ * The capture and firing ISRs share the MCPWM group 0 interrupt and must
+ * be allocated with the same level. The mains watchdog ISR uses it too, so
+ * no dimmer ISR preempts another and each keeps a single writer of the edge
+ * and tracker state. Every profile sets an explicit level, from 1 to 3.
+ *
+ * @return Interrupt priority for the MCPWM drivers.
+ */
+int power_profile_intr_priority(void);
@@ -0,0 +1,225 @@
+#include "settings.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "dimmer_state.h"
+#include "energy.h"
+#include "firing.h"
+#include "load_profile.h"
+#include "phase_lut.h"
+#include "power_profile.h"
+#include "transition.h"
+
+/* NVS namespace and key of the settings */
+#define SETTINGS_NVS_NAMESPACE "dimmer"
+#define SETTINGS_NVS_KEY "settings"
+
+/* Layout version of the saved settings, bumped on every change */
+#define SETTINGS_VERSION 3
+
+/* Interval between the checks of the settings in microseconds */
+#define SETTINGS_CHECK_INTERVAL_US 1000000
+
+/* Tag used in the log messages */
+static const char *TAG = "SETTINGS";
+
+/**
+ * @brief Settings saved in NVS.
+ */
+typedef struct {
+    uint8_t version;
+
+    /* Profile of the power profile module */
+    uint8_t profile;
+
+    /* Brightness curve and load profile of every channel */
+    uint8_t curves[FIRING_MAX_CHANNELS];
+    uint8_t loads[FIRING_MAX_CHANNELS];
+
+    /* Brightness every channel is heading to */
+    uint16_t levels[FIRING_MAX_CHANNELS];
+
+    /* Rated power of the load of every channel in watts */
+    uint16_t rated[FIRING_MAX_CHANNELS];
+} settings_t;
+
+/* Settings last committed and settings waiting to be stable */
+static settings_t saved;
+static settings_t pending;
+
+/* Time the pending settings last changed in microseconds */
+static int64_t pending_time = 0;
+
+/* Timer checking the settings for changes */
+static esp_timer_handle_t check_timer;
+
+/**
+ * @brief Takes a snapshot of the current settings.
+ *
+ * @param settings Destination of the snapshot.
+ *
+ * @return void
+ */
+static void settings_read(settings_t *settings)
+{
+    /* Clear the padding too, the snapshots are compared as a whole */
+    memset(settings, 0, sizeof(*settings));
+
+    settings->version = SETTINGS_VERSION;
+    settings->profile = power_profile_get();
+
+    for (size_t channel = 0; channel < CONFIG_DIMMER_CHANNEL_COUNT;
+         channel++) {
+        settings->curves[channel] = phase_lut_get_curve(channel);
+        settings->loads[channel] = load_profile_get(channel);
+        settings->levels[channel] = transition_get_target(channel);
+        settings->rated[channel] = energy_get_rated(channel);
+    }
+}
+
+/**
+ * @brief Writes the settings to NVS.
+ *
+ * @param settings Settings to write.
+ *
+ * @return ESP_OK on success.
+ */
+static esp_err_t settings_write(const settings_t *settings)
+{
+    esp_err_t ret;
+    nvs_handle_t handle;
+
+    ret = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = nvs_set_blob(handle, SETTINGS_NVS_KEY, settings, sizeof(*settings));
+
+    if (ret == ESP_OK) {
+        ret = nvs_commit(handle);
+    }
+
+    nvs_close(handle);
+
+    return ret;
+}
+
+/**
+ * @brief Checks the settings for changes, runs on the timer task.
+ *
+ * Every change restarts the delay, so only settings that stopped moving
+ * reach the flash.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void settings_check(void *arg)
+{
+    settings_t current;
+
+    settings_read(&current);
+
+    const int64_t now = esp_timer_get_time();
+
+    if (memcmp(&current, &pending, sizeof(current)) != 0) {
+        pending = current;
+        pending_time = now;
+        return;
+    }
+
+    if (memcmp(&pending, &saved, sizeof(pending)) == 0 ||
+        now - pending_time <
+            (int64_t)CONFIG_DIMMER_SETTINGS_COMMIT_DELAY_S * 1000000) {
+        return;
+    }
+
+    const esp_err_t ret = settings_write(&pending);
+
+    if (ret != ESP_OK) {
+        /* Retried once the delay elapses again */
+        ESP_LOGE(TAG, "Failed to save the settings: %s", esp_err_to_name(ret));
+        pending_time = now;
+        return;
+    }
+
+    saved = pending;
+}
+
+/**
+ * @brief Reads the settings from NVS and applies them.
+ *
+ * @return void
+ */
+static void settings_restore(void)
+{
+    nvs_handle_t handle;
+    settings_t settings;
+    size_t length = sizeof(settings);
+
+    if (nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+
+    const esp_err_t ret =
+        nvs_get_blob(handle, SETTINGS_NVS_KEY, &settings, &length);
+
+    nvs_close(handle);
+
+    /* Nothing saved yet, or saved by a firmware with another layout */
+    if (ret != ESP_OK || length != sizeof(settings) ||
+        settings.version != SETTINGS_VERSION) {
+        return;
+    }
+
+    power_profile_init((power_profile_t)settings.profile);
+
+    for (size_t channel = 0; channel < CONFIG_DIMMER_CHANNEL_COUNT;
+         channel++) {
+        if (settings.curves[channel] < PHASE_LUT_CURVE_MAX) {
+            phase_lut_set_curve(channel,
+                                (phase_lut_curve_t)settings.curves[channel]);
+        }
+
+        if (settings.loads[channel] < LOAD_PROFILE_MAX) {
+            load_profile_set(channel, (load_profile_t)settings.loads[channel]);
+        }
+
+        energy_set_rated(channel, settings.rated[channel]);
+
+        const uint16_t level = (settings.levels[channel] > PHASE_LUT_LEVEL_MAX)
+                                   ? PHASE_LUT_LEVEL_MAX
+                                   : settings.levels[channel];
+
+        /* Fire the very first cycle at the saved level */
+        dimmer_state_set_level(channel, level);
+        transition_start(channel, level, 0, TRANSITION_EASING_LINEAR);
+    }
+
+    ESP_LOGI(TAG, "Restored the saved settings");
+}
+
+void settings_init(void)
+{
+    esp_err_t ret;
+
+    settings_restore();
+
+    /* The restored settings are the saved ones */
+    settings_read(&saved);
+    pending = saved;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = settings_check,
+        .name = "settings",
+    };
+
+    ret = esp_timer_create(&timer_args, &check_timer);
+    ESP_ERROR_CHECK(ret);
+
+    ret = esp_timer_start_periodic(check_timer, SETTINGS_CHECK_INTERVAL_US);
+    ESP_ERROR_CHECK(ret);
+}
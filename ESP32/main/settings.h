@@ -0,0 +1,16 @@
+#pragma once
+
+/**
+ * @brief Restores the saved settings and starts saving their changes.
+ *
+ * Restores the brightness, the curve, the load profile and the rated power
+ * of every channel and the power profile from NVS, so it must run after
+ * the NVS initialization and before the first zero-crossing edge is
+ * serviced, and before the profile is applied. Then checks the settings
+ * for changes every second, and commits them once they have been stable
+ * for CONFIG_DIMMER_SETTINGS_COMMIT_DELAY_S seconds, so a slider dragged
+ * around costs a single flash write.
+ *
+ * @return void
+ */
+void settings_init(void);
@@ -0,0 +1,299 @@
+#include "transition.h"
+#include <stdatomic.h>
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "dimmer_state.h"
+
+/* Layout of a request word, zero means no request */
+#define TRANSITION_REQUEST_VALID (1UL << 31)
+#define TRANSITION_EASING_SHIFT 29
+#define TRANSITION_EASING_MASK 0x3
+#define TRANSITION_TARGET_SHIFT 19
+#define TRANSITION_TARGET_MASK 0x3FF
+#define TRANSITION_DURATION_MASK 0x7FFFF
+
+/* Fixed point of the transition progress, Q24 leaves room for long fades */
+#define TRANSITION_PROGRESS_SHIFT 24
+
+/* Q16 fraction representing a finished transition */
+#define TRANSITION_ONE 65536
+
+/**
+ * @brief Transition in progress, owned by the firing path.
+ */
+typedef struct {
+    /* Levels at the start and at the end of the transition */
+    uint16_t start;
+    uint16_t target;
+
+    /* Easing curve applied to the progress */
+    transition_easing_t easing;
+
+    /* Firing windows done and in total */
+    uint32_t step;
+    uint32_t steps;
+
+    /* Progress in Q24 and its increment per firing window */
+    uint32_t progress;
+    uint32_t increment;
+} transition_t;
+
+static transition_t transitions[FIRING_MAX_CHANNELS];
+
+/* Pending request of every channel, taken by the firing path */
+static atomic_uint requests[FIRING_MAX_CHANNELS];
+
+/* Requests of a batch, handed to the firing path all at once */
+static uint32_t batch_requests[FIRING_MAX_CHANNELS];
+
+/* Mask of the channels of a pending batch, and the flags below */
+static atomic_uint batch_state = 0;
+
+/* Earliest firing window of the pending batch, 0 for the next one */
+static uint64_t batch_start_time = 0;
+
+/* Batch flags while the firing path copies it and while a task writes it */
+#define TRANSITION_BATCH_TAKING (1UL << 31)
+#define TRANSITION_BATCH_WRITING (1UL << 30)
+
+/* Public state of every channel */
+static atomic_bool is_active[FIRING_MAX_CHANNELS];
+static atomic_uint targets[FIRING_MAX_CHANNELS];
+
+/**
+ * @brief Applies an easing curve to the progress of a transition.
+ *
+ * @param easing Easing curve.
+ * @param progress Progress as a Q16 fraction, from 0 to TRANSITION_ONE.
+ *
+ * @return Eased progress as a Q16 fraction.
+ */
+static uint32_t IRAM_ATTR transition_ease(transition_easing_t easing,
+                                          uint32_t progress)
+{
+    const uint64_t square = ((uint64_t)progress * progress) >> 16;
+    const uint32_t remaining = TRANSITION_ONE - progress;
+
+    switch (easing) {
+    case TRANSITION_EASING_IN:
+        return (uint32_t)square;
+
+    case TRANSITION_EASING_OUT:
+        return TRANSITION_ONE -
+               (uint32_t)(((uint64_t)remaining * remaining) >> 16);
+
+    case TRANSITION_EASING_IN_OUT:
+        /* 3p^2 - 2p^3 */
+        return (uint32_t)((square * (3 * TRANSITION_ONE - 2 * progress)) >>
+                          16);
+
+    case TRANSITION_EASING_LINEAR:
+    default:
+        return progress;
+    }
+}
+
+/**
+ * @brief Marks the transition of a channel as finished.
+ *
+ * @param channel Index of the channel.
+ *
+ * @return void
+ */
+static void IRAM_ATTR transition_finish(size_t channel)
+{
+    const uint32_t batch =
+        atomic_load_explicit(&batch_state, memory_order_relaxed);
+
+    /* Keep reporting active if a new request came in meanwhile */
+    if (atomic_load_explicit(&requests[channel], memory_order_relaxed) == 0 &&
+        !(batch & (1UL << channel))) {
+        atomic_store_explicit(&is_active[channel], false,
+                              memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Packs a transition into a request word.
+ *
+ * Also publishes the target and the active state of the channel.
+ *
+ * @param channel Index of the channel.
+ * @param target Brightness level from 0 to PHASE_LUT_LEVEL_MAX.
+ * @param duration Duration in milliseconds.
+ * @param easing Easing curve of the transition.
+ *
+ * @return Request word.
+ */
+static uint32_t transition_encode(size_t channel, uint16_t target,
+                                  uint32_t duration,
+                                  transition_easing_t easing)
+{
+    if (duration > TRANSITION_MAX_DURATION_MS) {
+        duration = TRANSITION_MAX_DURATION_MS;
+    }
+
+    if (easing >= TRANSITION_EASING_MAX) {
+        easing = TRANSITION_EASING_LINEAR;
+    }
+
+    atomic_store_explicit(&targets[channel], target, memory_order_relaxed);
+    atomic_store_explicit(&is_active[channel], true, memory_order_relaxed);
+
+    return TRANSITION_REQUEST_VALID |
+           ((uint32_t)easing << TRANSITION_EASING_SHIFT) |
+           ((uint32_t)(target & TRANSITION_TARGET_MASK)
+            << TRANSITION_TARGET_SHIFT) |
+           duration;
+}
+
+void transition_start(size_t channel, uint16_t target, uint32_t duration,
+                      transition_easing_t easing)
+{
+    const uint32_t request =
+        transition_encode(channel, target, duration, easing);
+
+    /* A request not taken yet is simply replaced by the newer one */
+    atomic_store_explicit(&requests[channel], request, memory_order_release);
+}
+
+void transition_start_batch(const transition_request_t *batch, size_t count,
+                            uint64_t start_time)
+{
+    unsigned int mask;
+
+    /* Lock the batch, against the firing path and the other tasks */
+    for (;;) {
+        mask = atomic_load_explicit(&batch_state, memory_order_acquire);
+
+        /* The firing path is copying it, only a few cycles */
+        if (mask & TRANSITION_BATCH_TAKING) {
+            continue;
+        }
+
+        /* Another task is writing it, and may be preempted by this one */
+        if (mask & TRANSITION_BATCH_WRITING) {
+            vTaskDelay(1);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(
+                &batch_state, &mask, mask | TRANSITION_BATCH_WRITING,
+                memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    /* A batch not taken yet is merged, the newer requests win */
+    for (size_t i = 0; i < count; i++) {
+        const size_t channel = batch[i].channel;
+
+        if (channel >= FIRING_MAX_CHANNELS) {
+            continue;
+        }
+
+        batch_requests[channel] = transition_encode(
+            channel, batch[i].target, batch[i].duration, batch[i].easing);
+        mask |= 1UL << channel;
+    }
+
+    batch_start_time = start_time;
+
+    atomic_store_explicit(&batch_state, mask, memory_order_release);
+}
+
+void IRAM_ATTR transition_take_batch(uint64_t now)
+{
+    unsigned int mask = atomic_load_explicit(&batch_state,
+                                             memory_order_acquire);
+
+    if (mask == 0 ||
+        (mask & (TRANSITION_BATCH_TAKING | TRANSITION_BATCH_WRITING)) ||
+        !atomic_compare_exchange_strong_explicit(
+            &batch_state, &mask, TRANSITION_BATCH_TAKING,
+            memory_order_acquire, memory_order_relaxed)) {
+        return;
+    }
+
+    /* Not due yet, leave it for a later firing window */
+    if ((int64_t)(now - batch_start_time) < 0) {
+        atomic_store_explicit(&batch_state, mask, memory_order_release);
+        return;
+    }
+
+    /* The steps of this firing window pick them all up together */
+    for (size_t channel = 0; channel < FIRING_MAX_CHANNELS; channel++) {
+        if (mask & (1UL << channel)) {
+            atomic_store_explicit(&requests[channel], batch_requests[channel],
+                                  memory_order_relaxed);
+        }
+    }
+
+    atomic_store_explicit(&batch_state, 0, memory_order_release);
+}
+
+void IRAM_ATTR transition_step(size_t channel, uint32_t period)
+{
+    transition_t *transition = &transitions[channel];
+
+    const uint32_t request = atomic_exchange_explicit(&requests[channel], 0,
+                                                      memory_order_acquire);
+
+    /* New request, restart from the current level */
+    if (request != 0) {
+        const uint32_t duration = request & TRANSITION_DURATION_MASK;
+
+        transition->start = dimmer_state_get_level(channel);
+        transition->target =
+            (request >> TRANSITION_TARGET_SHIFT) & TRANSITION_TARGET_MASK;
+        transition->easing =
+            (request >> TRANSITION_EASING_SHIFT) & TRANSITION_EASING_MASK;
+        transition->step = 0;
+        transition->steps = (period > 0) ? duration * 1000 / period : 0;
+        transition->progress = 0;
+
+        /* Shorter than a firing window, jump to the target */
+        if (transition->steps <= 1) {
+            dimmer_state_set_level(channel, transition->target);
+            transition->steps = 0;
+            transition_finish(channel);
+            return;
+        }
+
+        transition->increment =
+            (1UL << TRANSITION_PROGRESS_SHIFT) / transition->steps;
+    }
+
+    if (transition->step >= transition->steps) {
+        return;
+    }
+
+    /* Last firing window, land exactly on the target */
+    if (++transition->step >= transition->steps) {
+        dimmer_state_set_level(channel, transition->target);
+        transition_finish(channel);
+        return;
+    }
+
+    transition->progress += transition->increment;
+
+    const uint32_t eased = transition_ease(
+        transition->easing,
+        transition->progress >> (TRANSITION_PROGRESS_SHIFT - 16));
+    const int32_t span = (int32_t)transition->target - transition->start;
+
+    dimmer_state_set_level(
+        channel, (uint16_t)(transition->start +
+                            (((int64_t)span * eased) >> 16)));
+}
+
+bool transition_is_active(size_t channel)
+{
+    return atomic_load_explicit(&is_active[channel], memory_order_relaxed);
+}
+
+uint16_t transition_get_target(size_t channel)
+{
+    return atomic_load_explicit(&targets[channel], memory_order_relaxed);
+}
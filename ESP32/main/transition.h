@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Longest transition in milliseconds */
+#define TRANSITION_MAX_DURATION_MS 524287
+
+/**
+ * @brief Easing curves of a transition.
+ */
+typedef enum {
+    /* Constant rate of change */
+    TRANSITION_EASING_LINEAR = 0,
+
+    /* Starts slow and speeds up */
+    TRANSITION_EASING_IN,
+
+    /* Starts fast and slows down */
+    TRANSITION_EASING_OUT,
+
+    /* Starts and ends slow (smoothstep) */
+    TRANSITION_EASING_IN_OUT,
+
+    TRANSITION_EASING_MAX,
+} transition_easing_t;
+
+/**
+ * @brief Transition of one channel in a batch.
+ */
+typedef struct {
+    /* Index of the channel, below FIRING_MAX_CHANNELS */
+    size_t channel;
+
+    /* Brightness level from 0 to PHASE_LUT_LEVEL_MAX */
+    uint16_t target;
+
+    /* Duration in milliseconds, up to TRANSITION_MAX_DURATION_MS */
+    uint32_t duration;
+
+    /* Easing curve of the transition */
+    transition_easing_t easing;
+} transition_request_t;
+
+/**
+ * @brief Starts a transition of a channel towards a brightness level.
+ *
+ * The request is handed to the firing path in a single atomic word and
+ * picked up on the next firing window, where it replaces any transition in
+ * progress, starting from the current level. A zero duration sets the
+ * level on the next firing window.
+ *
+ * @param channel Index of the channel, below FIRING_MAX_CHANNELS.
+ * @param target Brightness level from 0 to PHASE_LUT_LEVEL_MAX.
+ * @param duration Duration in milliseconds, up to TRANSITION_MAX_DURATION_MS.
+ * @param easing Easing curve of the transition.
+ *
+ * @return void
+ */
+void transition_start(size_t channel, uint16_t target, uint32_t duration,
+                      transition_easing_t easing);
+
+/**
+ * @brief Starts the transitions of several channels in the same window.
+ *
+ * The whole batch is handed to the firing path at once, so all its
+ * transitions start on the same firing window, the first one whose rising
+ * edge comes at or after the start time. A batch not picked up yet is
+ * merged with the new one, which also sets its start time. Safe to call
+ * from several tasks.
+ *
+ * @param batch Transitions to start, one per channel.
+ * @param count Number of transitions.
+ * @param start_time Earliest start on the esp_timer timeline in
+ * microseconds, 0 for the next firing window.
+ *
+ * @return void
+ */
+void transition_start_batch(const transition_request_t *batch, size_t count,
+                            uint64_t start_time);
+
+/**
+ * @brief Hands a due batch to the transitions of the firing path.
+ *
+ * Must only be called from the firing path, once per firing window and
+ * before the transitions are stepped. Safe to call from an ISR.
+ *
+ * @param now Timestamp of the edge starting the firing window, on the
+ * esp_timer timeline in microseconds.
+ *
+ * @return void
+ */
+void transition_take_batch(uint64_t now);
+
+/**
+ * @brief Advances the transition of a channel by one firing window.
+ *
+ * Must only be called from the firing path, once per firing window and
+ * before the trigger delay is calculated. Updates the level of the channel
+ * in the shared state. Integer only, safe to call from an ISR.
+ *
+ * @param channel Index of the channel, below FIRING_MAX_CHANNELS.
+ * @param period Time between firing windows in microseconds.
+ *
+ * @return void
+ */
+void transition_step(size_t channel, uint32_t period);
+
+/**
+ * @brief Checks whether a channel is in the middle of a transition.
+ *
+ * @param channel Index of the channel, below FIRING_MAX_CHANNELS.
+ *
+ * @return true while a transition is pending or in progress.
+ */
+bool transition_is_active(size_t channel);
+
+/**
+ * @brief Gets the level the channel is heading to.
+ *
+ * @param channel Index of the channel, below FIRING_MAX_CHANNELS.
+ *
+ * @return Target of the last transition, from 0 to PHASE_LUT_LEVEL_MAX.
+ */
+uint16_t transition_get_target(size_t channel);
@@ -0,0 +1,278 @@
+#include "udp_control.h"
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "dimmer_state.h"
+#include "firing.h"
+#include "transition.h"
+#include "ws_control.h"
+
+/* Stack size of the listener task */
+#define UDP_CONTROL_TASK_STACK_SIZE 3072
+
+/* Senders whose sequence numbers are tracked at the same time */
+#define UDP_CONTROL_MAX_SENDERS 4
+
+/* Time after the last accepted packet of a sender before it is forgotten,
+ * so a restarted sender counting from a low sequence number gets through */
+#define UDP_CONTROL_SENDER_TIMEOUT_US 10000000
+
+/* Tag used in the log messages */
+static const char *TAG = "UDP_CONTROL";
+
+/**
+ * @brief Last accepted sequence number of a sender.
+ */
+typedef struct {
+    uint32_t address;
+    uint16_t port;
+    uint32_t sequence;
+    uint32_t last_used;
+    int64_t accepted_time;
+    bool is_used;
+} udp_control_sender_t;
+
+static udp_control_sender_t senders[UDP_CONTROL_MAX_SENDERS];
+
+/* Counter ordering the use of the senders, to replace the oldest one */
+static uint32_t use_counter = 0;
+
+/**
+ * @brief Reads a little endian 16-bit field.
+ *
+ * @param data First byte of the field.
+ *
+ * @return Field value.
+ */
+static uint16_t udp_control_read_u16(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+/**
+ * @brief Reads a little endian 32-bit field.
+ *
+ * @param data First byte of the field.
+ *
+ * @return Field value.
+ */
+static uint32_t udp_control_read_u32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) |
+           ((uint32_t)data[3] << 24);
+}
+
+/**
+ * @brief Checks the sequence number of a packet against its sender.
+ *
+ * Sequence numbers are compared with serial number arithmetic, so they may
+ * wrap around. A sender not seen yet takes the slot of the oldest one. Any
+ * sequence number is accepted from a sender without an accepted packet for
+ * UDP_CONTROL_SENDER_TIMEOUT_US, which resynchronizes a restarted one.
+ *
+ * @param source Address of the sender.
+ * @param sequence Sequence number of the packet.
+ *
+ * @return true if the packet is newer than the last one of the sender.
+ */
+static bool udp_control_is_newer(const struct sockaddr_in *source,
+                                 uint32_t sequence)
+{
+    udp_control_sender_t *oldest = &senders[0];
+    const int64_t now = esp_timer_get_time();
+
+    use_counter++;
+
+    for (int i = 0; i < UDP_CONTROL_MAX_SENDERS; i++) {
+        udp_control_sender_t *sender = &senders[i];
+
+        if (sender->is_used && sender->address == source->sin_addr.s_addr &&
+            sender->port == source->sin_port) {
+
+            if ((int32_t)(sequence - sender->sequence) <= 0 &&
+                now - sender->accepted_time < UDP_CONTROL_SENDER_TIMEOUT_US) {
+                return false;
+            }
+
+            sender->sequence = sequence;
+            sender->last_used = use_counter;
+            sender->accepted_time = now;
+            return true;
+        }
+
+        if (!sender->is_used ||
+            (oldest->is_used && sender->last_used < oldest->last_used)) {
+            oldest = sender;
+        }
+    }
+
+    oldest->address = source->sin_addr.s_addr;
+    oldest->port = source->sin_port;
+    oldest->sequence = sequence;
+    oldest->last_used = use_counter;
+    oldest->accepted_time = now;
+    oldest->is_used = true;
+
+    return true;
+}
+
+/**
+ * @brief Applies a command packet.
+ *
+ * @param packet Command packet.
+ * @param source Address of the sender.
+ *
+ * @return Status reported in the acknowledgement.
+ */
+static udp_control_status_t udp_control_apply(const uint8_t *packet,
+                                              const struct sockaddr_in *source)
+{
+    const size_t channel = packet[UDP_CONTROL_PACKET_CHANNEL];
+    const size_t count = firing_channel_count();
+
+    if (channel >= count && channel != UDP_CONTROL_CHANNEL_ALL) {
+        return UDP_CONTROL_STATUS_INVALID;
+    }
+
+    if (!udp_control_is_newer(
+            source,
+            udp_control_read_u32(&packet[UDP_CONTROL_PACKET_SEQUENCE]))) {
+        return UDP_CONTROL_STATUS_STALE;
+    }
+
+    uint16_t level = udp_control_read_u16(&packet[UDP_CONTROL_PACKET_LEVEL]);
+    const uint32_t fade =
+        udp_control_read_u16(&packet[UDP_CONTROL_PACKET_FADE]);
+    const transition_easing_t easing =
+        (transition_easing_t)packet[UDP_CONTROL_PACKET_EASING];
+
+    if (level > PHASE_LUT_LEVEL_MAX) {
+        level = PHASE_LUT_LEVEL_MAX;
+    }
+
+    if (channel == UDP_CONTROL_CHANNEL_ALL) {
+        for (size_t i = 0; i < count; i++) {
+            transition_start(i, level, fade, easing);
+        }
+    } else {
+        transition_start(channel, level, fade, easing);
+    }
+
+    ws_control_notify();
+
+    return UDP_CONTROL_STATUS_APPLIED;
+}
+
+/**
+ * @brief Creates the listening socket.
+ *
+ * @return Socket descriptor, negative on failure.
+ */
+static int udp_control_open(void)
+{
+    const int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to create socket");
+        return sock;
+    }
+
+    const int enable = 1;
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    const struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_DIMMER_UDP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+
+    if (bind(sock, (const struct sockaddr *)&address, sizeof(address)) < 0) {
+        ESP_LOGE(TAG, "Failed to bind port %d", CONFIG_DIMMER_UDP_PORT);
+        close(sock);
+        return -1;
+    }
+
+#if CONFIG_DIMMER_UDP_MULTICAST
+    /* Also receive the packets of the group, on the default interface */
+    struct ip_mreq group = {
+        .imr_interface.s_addr = htonl(INADDR_ANY),
+    };
+
+    inet_aton(CONFIG_DIMMER_UDP_MULTICAST_GROUP, &group.imr_multiaddr);
+
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group,
+                   sizeof(group)) < 0) {
+        ESP_LOGW(TAG, "Failed to join group %s",
+                 CONFIG_DIMMER_UDP_MULTICAST_GROUP);
+    }
+#endif
+
+    return sock;
+}
+
+/**
+ * @brief Receives and applies the command packets.
+ *
+ * @param arg Not used in this implementation.
+ */
+static void udp_control_task(void *arg)
+{
+    const int sock = udp_control_open();
+
+    if (sock < 0) {
+        vTaskDelete(NULL);
+        return;
+    }
+
+    /* One byte more than a command, so longer datagrams are not cut down
+     * to a valid length and rejected instead */
+    uint8_t packet[UDP_CONTROL_PACKET_LENGTH + 1];
+
+    /* Infinity loop */
+    for (;;) {
+        struct sockaddr_in source;
+        socklen_t source_length = sizeof(source);
+
+        const int length =
+            recvfrom(sock, packet, sizeof(packet), 0,
+                     (struct sockaddr *)&source, &source_length);
+
+        if (length < 1) {
+            continue;
+        }
+
+        const udp_control_status_t status =
+            (length == UDP_CONTROL_PACKET_LENGTH)
+                ? udp_control_apply(packet, &source)
+                : UDP_CONTROL_STATUS_INVALID;
+
+        if (!(packet[UDP_CONTROL_PACKET_FLAGS] &
+              UDP_CONTROL_FLAG_ACK_REQUEST) ||
+            length < UDP_CONTROL_PACKET_CHANNEL) {
+            continue;
+        }
+
+        /* Acknowledge with the sequence number of the command */
+        uint8_t ack[UDP_CONTROL_ACK_LENGTH];
+
+        ack[UDP_CONTROL_ACK_FLAGS] = UDP_CONTROL_FLAG_ACK;
+        memcpy(&ack[UDP_CONTROL_ACK_SEQUENCE],
+               &packet[UDP_CONTROL_PACKET_SEQUENCE], 4);
+        ack[UDP_CONTROL_ACK_STATUS] = status;
+
+        sendto(sock, ack, sizeof(ack), 0, (const struct sockaddr *)&source,
+               source_length);
+    }
+}
+
+void udp_control_init(void)
+{
+    /* Network core, next to the Wi-Fi and lwIP tasks */
+    xTaskCreatePinnedToCore(udp_control_task, "udp_control",
+                            UDP_CONTROL_TASK_STACK_SIZE, NULL, 5, NULL, 0);
+}
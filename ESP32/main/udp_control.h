@@ -0,0 +1,54 @@
+#pragma once
+
+/* Layout of a command packet, multi-byte fields are little endian */
+#define UDP_CONTROL_PACKET_FLAGS 0
+#define UDP_CONTROL_PACKET_SEQUENCE 1
+#define UDP_CONTROL_PACKET_CHANNEL 5
+#define UDP_CONTROL_PACKET_LEVEL 6
+#define UDP_CONTROL_PACKET_FADE 8
+#define UDP_CONTROL_PACKET_EASING 10
+#define UDP_CONTROL_PACKET_LENGTH 11
+
+/* Layout of an acknowledgement, sent back to the sender of the command */
+#define UDP_CONTROL_ACK_FLAGS 0
+#define UDP_CONTROL_ACK_SEQUENCE 1
+#define UDP_CONTROL_ACK_STATUS 5
+#define UDP_CONTROL_ACK_LENGTH 6
+
+/* Flags of the packets */
+#define UDP_CONTROL_FLAG_ACK_REQUEST (1 << 0)
+#define UDP_CONTROL_FLAG_ACK (1 << 1)
+
+/* Channel addressing all the channels at once */
+#define UDP_CONTROL_CHANNEL_ALL 0xFF
+
+/**
+ * @brief Status of a command, reported in the acknowledgement.
+ */
+typedef enum {
+    /* Command handed to the firing path */
+    UDP_CONTROL_STATUS_APPLIED = 0,
+
+    /* Sequence number not newer than the last one of the sender */
+    UDP_CONTROL_STATUS_STALE,
+
+    /* Malformed packet or unknown channel */
+    UDP_CONTROL_STATUS_INVALID,
+} udp_control_status_t;
+
+/**
+ * @brief Starts the UDP control listener.
+ *
+ * Listens on CONFIG_DIMMER_UDP_PORT, and optionally on a multicast group so
+ * a single packet drives many dimmers at once. Each sender has its own
+ * sequence numbers, and packets that are not newer than the last accepted
+ * one of their sender are dropped, so a late or duplicated datagram never
+ * rolls the brightness back. A sender is forgotten 10 seconds after its
+ * last accepted packet, so a controller that restarts from a low sequence
+ * number is followed again after at most that time. Commands with the
+ * acknowledgement flag get a reply with the same sequence number and the
+ * status of the command.
+ *
+ * @return void
+ */
+void udp_control_init(void);
@@ -0,0 +1,309 @@
+#include "ws_control.h"
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "ble_control.h"
+#include "dimmer_state.h"
+#include "energy.h"
+#include "firing.h"
+#include "mains_tracker.h"
+#include "transition.h"
+
+/* Frequency change that is pushed even without any other change */
+#define WS_CONTROL_FREQUENCY_THRESHOLD_MHZ 50
+
+/* Tag used in the log messages */
+static const char *TAG = "WS_CONTROL";
+
+/* Server running the endpoint */
+static httpd_handle_t ws_server = NULL;
+
+/* Flag set while a state push is queued on the server task */
+static atomic_bool is_push_queued = false;
+
+/* Flag forcing the next check to push, even without a change */
+static atomic_bool is_push_forced = false;
+
+/* Timer checking the state for changes at the push rate */
+static esp_timer_handle_t push_timer;
+
+/* State frame being pushed, and its length */
+static uint8_t push_payload[WS_CONTROL_STATE_MAX_LENGTH];
+static size_t push_length = 0;
+
+/* Frequency of the last pushed frame in millihertz */
+static uint32_t push_frequency = 0;
+
+/**
+ * @brief Writes a little endian 16-bit field.
+ *
+ * @param data First byte of the field.
+ * @param value Field value.
+ *
+ * @return void
+ */
+static void ws_control_write_u16(uint8_t *data, uint16_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+size_t ws_control_build_state(uint8_t *payload, uint32_t *frequency)
+{
+    const size_t count = firing_channel_count();
+
+    dimmer_edges_t edges;
+
+    dimmer_state_read_edges(&edges);
+
+    /* Lost by the edge watchdog, or not seen since boot */
+    const bool is_mains_lost = edges.is_mains_lost || edges.rising_time == 0;
+
+    *frequency = is_mains_lost ? 0 : mains_tracker_frequency(edges.period);
+
+    payload[WS_CONTROL_STATE_COUNT] = count;
+    payload[WS_CONTROL_STATE_FLAGS] =
+        edges.is_locked ? WS_CONTROL_STATE_LOCKED : 0;
+    payload[WS_CONTROL_STATE_FAULTS] =
+        is_mains_lost ? WS_CONTROL_FAULT_NO_MAINS : 0;
+
+    for (int i = 0; i < 4; i++) {
+        payload[WS_CONTROL_STATE_FREQUENCY + i] = *frequency >> (8 * i);
+    }
+
+    for (size_t channel = 0; channel < count; channel++) {
+        uint8_t *record = &payload[WS_CONTROL_STATE_HEADER_LENGTH +
+                                   channel * WS_CONTROL_STATE_RECORD_LENGTH];
+
+        ws_control_write_u16(&record[WS_CONTROL_STATE_LEVEL],
+                             dimmer_state_get_level(channel));
+        ws_control_write_u16(&record[WS_CONTROL_STATE_TARGET],
+                             transition_get_target(channel));
+        record[WS_CONTROL_STATE_CHANNEL_FLAGS] =
+            transition_is_active(channel) ? WS_CONTROL_STATE_FADING : 0;
+        ws_control_write_u16(&record[WS_CONTROL_STATE_POWER],
+                             (energy_get_power(channel) + 500) / 1000);
+    }
+
+    return WS_CONTROL_STATE_HEADER_LENGTH +
+           count * WS_CONTROL_STATE_RECORD_LENGTH;
+}
+
+/**
+ * @brief Sends the state frame to all the WebSocket clients, runs on the
+ * server task.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void ws_control_push(void *arg)
+{
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_BINARY,
+        .payload = push_payload,
+        .len = push_length,
+    };
+
+    int client_fds[CONFIG_LWIP_MAX_SOCKETS];
+    size_t client_count = CONFIG_LWIP_MAX_SOCKETS;
+
+    if (httpd_get_client_list(ws_server, &client_count, client_fds) ==
+        ESP_OK) {
+        for (size_t i = 0; i < client_count; i++) {
+            if (httpd_ws_get_fd_info(ws_server, client_fds[i]) ==
+                HTTPD_WS_CLIENT_WEBSOCKET) {
+                httpd_ws_send_frame_async(ws_server, client_fds[i], &frame);
+            }
+        }
+    }
+
+    /* The frame is sent, the next check may build a new one */
+    atomic_store(&is_push_queued, false);
+}
+
+/**
+ * @brief Checks the state for changes, runs on the timer task.
+ *
+ * Pushes at most one frame per period of the timer, which coalesces all
+ * the changes in between. Frequency changes below the push threshold do
+ * not count as a change on their own.
+ *
+ * @param arg Not used in this implementation.
+ *
+ * @return void
+ */
+static void ws_control_check(void *arg)
+{
+    /* The previous frame is still being sent */
+    if (atomic_load(&is_push_queued)) {
+        return;
+    }
+
+    uint8_t payload[sizeof(push_payload)];
+    uint32_t frequency;
+
+    const size_t length = ws_control_build_state(payload, &frequency);
+    const uint32_t drift = (frequency > push_frequency)
+                               ? frequency - push_frequency
+                               : push_frequency - frequency;
+
+    /* Compare all but the frequency, which is checked on its own */
+    memcpy(&payload[WS_CONTROL_STATE_FREQUENCY],
+           &push_payload[WS_CONTROL_STATE_FREQUENCY], 4);
+
+    const bool is_changed = length != push_length ||
+                            memcmp(payload, push_payload, length) != 0 ||
+                            drift >= WS_CONTROL_FREQUENCY_THRESHOLD_MHZ;
+
+    if (!atomic_exchange(&is_push_forced, false) && !is_changed) {
+        return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        payload[WS_CONTROL_STATE_FREQUENCY + i] = frequency >> (8 * i);
+    }
+
+    memcpy(push_payload, payload, length);
+    push_length = length;
+    push_frequency = frequency;
+
+    /* The BLE subscribers get the same rate-limited updates */
+    ble_control_notify();
+
+    atomic_store(&is_push_queued, true);
+
+    if (httpd_queue_work(ws_server, ws_control_push, NULL) != ESP_OK) {
+        atomic_store(&is_push_queued, false);
+    }
+}
+
+void ws_control_notify(void)
+{
+    /* Picked up by the next check, at most one push interval later */
+    atomic_store(&is_push_forced, true);
+}
+
+void ws_control_apply_frame(const uint8_t *payload, size_t length)
+{
+    if (length < WS_CONTROL_FRAME_MIN_LENGTH) {
+        return;
+    }
+
+    const size_t channel = payload[WS_CONTROL_FRAME_CHANNEL];
+
+    if (channel >= firing_channel_count()) {
+        return;
+    }
+
+    uint16_t level = payload[WS_CONTROL_FRAME_LEVEL] |
+                     (payload[WS_CONTROL_FRAME_LEVEL + 1] << 8);
+    uint32_t fade = 0;
+    transition_easing_t easing = TRANSITION_EASING_LINEAR;
+
+    if (level > PHASE_LUT_LEVEL_MAX) {
+        level = PHASE_LUT_LEVEL_MAX;
+    }
+
+    if (length >= WS_CONTROL_FRAME_FADE + 2) {
+        fade = payload[WS_CONTROL_FRAME_FADE] |
+               (payload[WS_CONTROL_FRAME_FADE + 1] << 8);
+    }
+
+    if (length >= WS_CONTROL_FRAME_EASING + 1) {
+        easing = (transition_easing_t)payload[WS_CONTROL_FRAME_EASING];
+    }
+
+    transition_start(channel, level, fade, easing);
+}
+
+/**
+ * @brief Handles the WebSocket handshake and the frames of "/ws".
+ *
+ * @param req Pointer to the HTTP request.
+ *
+ * @return ESP_OK on success, an error closes the connection.
+ */
+static esp_err_t ws_control_handler(httpd_req_t *req)
+{
+    esp_err_t ret;
+
+    /* Handshake done, send the frames without waiting to fill a segment */
+    if (req->method == HTTP_GET) {
+        const int enable = 1;
+
+        setsockopt(httpd_req_to_sockfd(req), IPPROTO_TCP, TCP_NODELAY,
+                   &enable, sizeof(enable));
+
+        ws_control_notify();
+        return ESP_OK;
+    }
+
+    uint8_t payload[WS_CONTROL_FRAME_MAX_LENGTH];
+
+    httpd_ws_frame_t frame = {
+        .payload = payload,
+    };
+
+    /* Read the length first, larger frames are not control frames */
+    ret = httpd_ws_recv_frame(req, &frame, 0);
+
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (frame.type != HTTPD_WS_TYPE_BINARY ||
+        frame.len > WS_CONTROL_FRAME_MAX_LENGTH) {
+        ESP_LOGW(TAG, "Dropped frame of type %d and length %u", frame.type,
+                 (unsigned)frame.len);
+        return ESP_FAIL;
+    }
+
+    if (frame.len > 0) {
+        ret = httpd_ws_recv_frame(req, &frame, frame.len);
+
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    ws_control_apply_frame(payload, frame.len);
+
+    ws_control_notify();
+
+    return ESP_OK;
+}
+
+void ws_control_register(httpd_handle_t server)
+{
+    esp_err_t ret;
+
+    ws_server = server;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = ws_control_check,
+        .name = "ws_control",
+    };
+
+    ret = esp_timer_create(&timer_args, &push_timer);
+    ESP_ERROR_CHECK(ret);
+
+    ret = esp_timer_start_periodic(push_timer,
+                                   CONFIG_DIMMER_WS_PUSH_INTERVAL_MS * 1000);
+    ESP_ERROR_CHECK(ret);
+
+    httpd_uri_t ws_uri = {
+        .uri = "/ws",
+        .method = HTTP_GET,
+        .handler = ws_control_handler,
+        .user_ctx = NULL,
+        .is_websocket = true,
+    };
+
+    /* Registers a URI handler for the WebSocket endpoint */
+    ret = httpd_register_uri_handler(server, &ws_uri);
+    ESP_ERROR_CHECK(ret);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_http_server.h"
+#include "firing.h"
+
+/* Layout of a control frame from the client, multi-byte fields are little
+ * endian. The fade and easing bytes are optional. */
+#define WS_CONTROL_FRAME_CHANNEL 0
+#define WS_CONTROL_FRAME_LEVEL 1
+#define WS_CONTROL_FRAME_FADE 3
+#define WS_CONTROL_FRAME_EASING 5
+#define WS_CONTROL_FRAME_MIN_LENGTH 3
+#define WS_CONTROL_FRAME_MAX_LENGTH 6
+
+/* Layout of a state frame pushed to the clients, a header followed by one
+ * record per channel */
+#define WS_CONTROL_STATE_COUNT 0
+#define WS_CONTROL_STATE_FLAGS 1
+#define WS_CONTROL_STATE_FAULTS 2
+#define WS_CONTROL_STATE_FREQUENCY 3
+#define WS_CONTROL_STATE_HEADER_LENGTH 7
+#define WS_CONTROL_STATE_LEVEL 0
+#define WS_CONTROL_STATE_TARGET 2
+#define WS_CONTROL_STATE_CHANNEL_FLAGS 4
+#define WS_CONTROL_STATE_POWER 5
+#define WS_CONTROL_STATE_RECORD_LENGTH 7
+#define WS_CONTROL_STATE_MAX_LENGTH \
+    (WS_CONTROL_STATE_HEADER_LENGTH + \
+     FIRING_MAX_CHANNELS * WS_CONTROL_STATE_RECORD_LENGTH)
+
+/* Flags of the state frame header and of the channel records */
+#define WS_CONTROL_STATE_LOCKED (1 << 0)
+#define WS_CONTROL_STATE_FADING (1 << 0)
+
+/* Faults of the state frame header */
+#define WS_CONTROL_FAULT_NO_MAINS (1 << 0)
+
+/**
+ * @brief Registers the WebSocket control endpoint on "/ws".
+ *
+ * Clients stream compact binary frames with the channel and the level, and
+ * get binary state frames back. Every frame replaces the previous request
+ * of its channel in the firing path, so a burst only applies the latest
+ * value.
+ *
+ * The state frames carry the brightness and the estimated power in watts
+ * of every channel, the mains lock, frequency and faults. They are pushed
+ * to every client whenever the state changes, at most once per
+ * CONFIG_DIMMER_WS_PUSH_INTERVAL_MS, so all the changes in between are
+ * coalesced in a single frame. A new client gets the state right away, and
+ * an empty binary frame requests a state push.
+ *
+ * @param server Running HTTP server.
+ *
+ * @return void
+ */
+void ws_control_register(httpd_handle_t server);
+
+/**
+ * @brief Pushes the state to all the WebSocket clients on the next check.
+ *
+ * Safe to call from any task. The push is sent within one push interval,
+ * even if the state did not change, and coalesced with any other push.
+ *
+ * @return void
+ */
+void ws_control_notify(void);
+
+/**
+ * @brief Applies a control frame.
+ *
+ * The frame layout is shared with the other binary control paths.
+ *
+ * @param payload Frame payload.
+ * @param length Frame length in bytes, at least WS_CONTROL_FRAME_MIN_LENGTH.
+ *
+ * @return void
+ */
+void ws_control_apply_frame(const uint8_t *payload, size_t length);
+
+/**
+ * @brief Builds the state frame.
+ *
+ * The frame layout is shared with the other binary control paths.
+ *
+ * @param payload Destination of the frame, WS_CONTROL_STATE_MAX_LENGTH long.
+ * @param frequency Destination of the mains frequency in millihertz.
+ *
+ * @return Frame length in bytes.
+ */
+size_t ws_control_build_state(uint8_t *payload, uint32_t *frequency);
@@ -0,0 +1,398 @@
+#include "zero_crossing.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "dimmer_state.h"
+#include "firing.h"
+#include "mains_tracker.h"
+#include "mains_watchdog.h"
+#include "metrics.h"
+#include "phase_lut.h"
+#include "transition.h"
+
+/* Number of TRIAC channels driven from the zero-crossing input */
+#define CHANNEL_COUNT CONFIG_DIMMER_CHANNEL_COUNT
+
+/* Edge state owned by the ISR, published through the shared state block */
+static dimmer_edges_t isr_edges = { 0 };
+
+/* Period tracker fed with the rising edges, owned by the ISR */
+static mains_tracker_t tracker;
+
+#if CONFIG_DIMMER_ISR_SCHEDULING
+#if CONFIG_DIMMER_FIRE_BOTH_HALVES
+/* Time the input stays high in microseconds, measured on the falling edge */
+static uint32_t high_time = 0;
+
+/**
+ * @brief Estimates the delay of the detector edges from the zero-crossings.
+ *
+ * The rising edge comes late and the falling edge early by the same amount, 
+ * so the deviation of the high time from a half period gives the offset.
+ *
+ * @return Delay in microseconds, negative if the edges come early.
+ */
+static int32_t IRAM_ATTR detector_delay(void)
+{
+    return ((int32_t)(isr_edges.period / 2) - (int32_t)high_time) / 2;
+}
+#endif
+
+/**
+ * @brief Gets the phase delay of a channel for its level and curve.
+ *
+ * @param channel Index of the channel.
+ * @param period Period of the firing window in microseconds.
+ *
+ * @return Delay from the zero-crossing in microseconds.
+ */
+static uint32_t IRAM_ATTR channel_delay(size_t channel, uint32_t period)
+{
+    return phase_lut_delay(channel, dimmer_state_get_level(channel), period);
+}
+
+/**
+ * @brief Records the time left before the earliest trigger once scheduled.
+ *
+ * The triggers are timed from the rising edge by the hardware, a trigger 
+ * scheduled after its time is missed for the window.
+ *
+ * @param earliest Earliest trigger from the rising edge in microseconds, 
+ * UINT32_MAX when no channel fires.
+ *
+ * @return void
+ */
+static void IRAM_ATTR record_margin(uint32_t earliest)
+{
+    if (earliest == UINT32_MAX) {
+        return;
+    }
+
+    const int32_t margin =
+        (int32_t)earliest -
+        (int32_t)(esp_timer_get_time() - isr_edges.rising_time);
+
+    metrics_record(METRICS_TRIGGER_MARGIN, margin);
+
+    if (margin < 0) {
+        metrics_count(METRICS_MISSED);
+    }
+}
+
+/**
+ * @brief Schedules the triggers of the cycle started by a rising edge.
+ *
+ * @return void
+ */
+static void IRAM_ATTR schedule_rising(void)
+{
+    /* Scenes start on all their channels in the same window */
+    transition_take_batch(isr_edges.rising_time);
+
+#if CONFIG_DIMMER_FIRE_BOTH_HALVES
+    const uint32_t half = isr_edges.period / 2;
+    const int32_t delay = detector_delay();
+
+    /* Release before the falling edge reprograms the comparators */
+    uint32_t end = (uint32_t)((int32_t)half - delay);
+
+    if (end > high_time) {
+        end = high_time;
+    }
+
+    uint32_t earliest = UINT32_MAX;
+
+    for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+        transition_step(channel, half);
+
+        /* Half-cycle from the zero-crossing before the rising edge */
+        const int32_t start = (int32_t)channel_delay(channel, half) - delay;
+        const uint32_t trigger_time = (start > 0) ? (uint32_t)start : 0;
+
+        firing_set_delay(channel, trigger_time, end);
+        dimmer_state_set_trigger(channel, trigger_time);
+
+        if (dimmer_state_get_level(channel) > 0 && trigger_time < earliest) {
+            earliest = trigger_time;
+        }
+    }
+
+    record_margin(earliest);
+#else
+    const uint32_t offset = dimmer_state_get_zero_crossing();
+    uint32_t earliest = UINT32_MAX;
+
+    for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+        transition_step(channel, isr_edges.period);
+
+        const uint32_t trigger_time =
+            channel_delay(channel, isr_edges.period) + offset;
+
+        /* Fire in the current cycle, the timer was reset by this edge */
+        firing_set_delay(channel, trigger_time, isr_edges.period);
+        dimmer_state_set_trigger(channel, trigger_time);
+
+        if (dimmer_state_get_level(channel) > 0 && trigger_time < earliest) {
+            earliest = trigger_time;
+        }
+    }
+
+    record_margin(earliest);
+#endif
+}
+
+/**
+ * @brief Updates the zero-crossing estimate on a falling edge.
+ *
+ * When firing both half-cycles, also schedules the trigger of the half-cycle 
+ * started by the falling edge, on the same timer that counts from the 
+ * rising edge.
+ *
+ * @return void
+ */
+static void IRAM_ATTR schedule_falling(void)
+{
+    const uint32_t elapsed =
+        (uint32_t)(isr_edges.falling_time - isr_edges.rising_time);
+
+#if CONFIG_DIMMER_FIRE_BOTH_HALVES
+    high_time = elapsed;
+
+    if (!isr_edges.is_locked) {
+        return;
+    }
+
+    const uint32_t half = isr_edges.period / 2;
+    const int32_t delay = detector_delay();
+
+    /* Half-cycle from the zero-crossing after the falling edge */
+    const uint32_t start = (uint32_t)((int32_t)elapsed + delay);
+
+    /* Release before the zero-crossing or the next rising edge */
+    uint32_t end = (uint32_t)((int32_t)isr_edges.period - delay);
+
+    if (end > isr_edges.period) {
+        end = isr_edges.period;
+    }
+
+    transition_take_batch(isr_edges.falling_time);
+
+    uint32_t earliest = UINT32_MAX;
+
+    for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+        transition_step(channel, half);
+
+        const uint32_t trigger_time = start + channel_delay(channel, half);
+
+        firing_set_delay(channel, trigger_time, end);
+
+        if (dimmer_state_get_level(channel) > 0 && trigger_time < earliest) {
+            earliest = trigger_time;
+        }
+    }
+
+    record_margin(earliest);
+#else
+    /* Calculate zero-crossing time */
+    dimmer_state_set_zero_crossing(elapsed >> 1);
+#endif
+}
+#endif
+
+void zero_crossing_init(void)
+{
+    /* Start unlocked, the first edges acquire the powergrid period */
+    mains_tracker_init(&tracker);
+}
+
+bool IRAM_ATTR zero_crossing_edge(uint64_t current_time, bool current_state)
+{
+    /* Flag holding whether the last rising edge was a genuine one */
+    static bool is_rising_genuine = false;
+
+    const esp_cpu_cycle_count_t entry_cycles = esp_cpu_get_cycle_count();
+
+    /* Time the edge waited for this ISR since the hardware latched it */
+    metrics_record(METRICS_ISR_LATENCY,
+                   (int32_t)(esp_timer_get_time() - current_time));
+
+    /* Rising edge detected */
+    if (current_state && !isr_edges.is_crossing_zero) {
+        const uint32_t estimate = mains_tracker_period(&tracker);
+
+        /* Deviation of this interval from the tracked period */
+        if (estimate != 0 && tracker.last_edge != 0) {
+            const int32_t error =
+                (int32_t)(current_time - tracker.last_edge) - (int32_t)estimate;
+
+            metrics_record(METRICS_PERIOD_ERROR, error);
+
+            if (error > (int32_t)(estimate >> MAINS_TRACKER_TOLERANCE_SHIFT) ||
+                error < -(int32_t)(estimate >> MAINS_TRACKER_TOLERANCE_SHIFT)) {
+                metrics_count(METRICS_OUTLIERS);
+            }
+        }
+
+        /* Filter the period, dropping edges rejected as glitches */
+        is_rising_genuine = mains_tracker_update(&tracker, current_time);
+
+        if (!is_rising_genuine) {
+            metrics_count(METRICS_GLITCHES);
+        }
+
+        if (isr_edges.is_locked && !tracker.is_locked) {
+            metrics_count(METRICS_UNLOCKS);
+        }
+
+        if (is_rising_genuine) {
+            /* Store the period in microseconds to calculate the trigger */
+            isr_edges.period = mains_tracker_period(&tracker);
+            isr_edges.rising_time = current_time;
+            isr_edges.is_timed_out = false;
+
+            /* Force the gates off if the next edges do not come */
+            if (isr_edges.period != 0) {
+                mains_watchdog_feed(isr_edges.period + isr_edges.period / 2);
+            }
+        }
+
+        isr_edges.is_locked = tracker.is_locked;
+
+        if (isr_edges.is_locked) {
+            isr_edges.is_mains_lost = false;
+        }
+
+#if CONFIG_DIMMER_ISR_SCHEDULING
+        /* Calculate the trigger of this cycle from its own edge */
+        if (is_rising_genuine && isr_edges.is_locked) {
+            schedule_rising();
+
+        /* A glitch restarted the timer too, skip the rest of this cycle */
+        } else {
+            metrics_count(METRICS_SKIPPED);
+
+            for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+                firing_set_delay(channel, 0, 0);
+            }
+        }
+#endif
+
+    /* Falling edge detected */
+    } else if (!current_state && isr_edges.is_crossing_zero) {
+        /* Store the falling time to estimate the zero-crossing time */
+        if (is_rising_genuine) {
+            isr_edges.falling_time = current_time;
+
+#if CONFIG_DIMMER_ISR_SCHEDULING
+            schedule_falling();
+#endif
+        }
+    }
+
+    /* Update the zero-crossing state and publish the snapshot */
+    isr_edges.is_crossing_zero = current_state;
+    dimmer_state_write_edges(&isr_edges);
+
+    metrics_record(METRICS_ISR_CYCLES,
+                   (int32_t)(esp_cpu_get_cycle_count() - entry_cycles));
+
+#if CONFIG_DIMMER_ISR_SCHEDULING
+    return false;
+#else
+    /* The control task does the rest of the work */
+    return true;
+#endif
+}
+
+bool IRAM_ATTR zero_crossing_timeout(void)
+{
+    /* Silence since the last genuine rising edge */
+    const uint64_t silence = esp_timer_get_time() - isr_edges.rising_time;
+
+    /* Beyond the missing edges bridged by the tracker, the mains is gone */
+    if (!isr_edges.is_mains_lost &&
+        silence > (uint64_t)(MAINS_TRACKER_MAX_MISSED + 1) * isr_edges.period) {
+        mains_tracker_lose(&tracker);
+
+        isr_edges.is_locked = false;
+        isr_edges.is_mains_lost = true;
+
+        metrics_count(METRICS_MAINS_LOSSES);
+    }
+
+    isr_edges.is_timed_out = true;
+    dimmer_state_write_edges(&isr_edges);
+
+#if CONFIG_DIMMER_ISR_SCHEDULING
+    /* Hold the gates low until an edge schedules them again */
+    for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+        firing_set_delay(channel, 0, 0);
+    }
+
+    return false;
+#else
+    /* The control task owns the firing engine */
+    return true;
+#endif
+}
+
+#if !CONFIG_DIMMER_ISR_SCHEDULING
+void zero_crossing_schedule(void)
+{
+    dimmer_edges_t edges;
+
+    /* Take a consistent copy of the state written by the ISR */
+    dimmer_state_read_edges(&edges);
+
+    /* The edges stopped, hold the gates low until they come back */
+    if (edges.is_timed_out) {
+        for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+            firing_set_delay(channel, 0, 0);
+        }
+
+        return;
+    }
+
+    metrics_record(METRICS_TASK_WAKEUP,
+                   (int32_t)(esp_timer_get_time() -
+                             (edges.is_crossing_zero
+                                  ? edges.rising_time
+                                  : edges.falling_time)));
+
+    if (edges.is_crossing_zero) {
+        const uint32_t offset = dimmer_state_get_zero_crossing();
+
+        /* Scenes start on all their channels in the same window */
+        transition_take_batch(edges.rising_time);
+
+        for (size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+            transition_step(channel, edges.period);
+
+            /* Calculate trigger time based on zero-crossing detection */
+            const uint32_t trigger_time =
+                phase_lut_delay(channel, dimmer_state_get_level(channel),
+                                edges.period) +
+                offset;
+
+            dimmer_state_set_trigger(channel, trigger_time);
+
+            /* Schedule the trigger for the next cycles once locked */
+            firing_set_delay(channel, trigger_time,
+                             edges.is_locked ? edges.period : 0);
+        }
+
+        /* The values are latched on the next rising edge */
+        if (edges.is_locked) {
+            metrics_record(METRICS_TRIGGER_MARGIN,
+                           (int32_t)edges.period -
+                               (int32_t)(esp_timer_get_time() -
+                                         edges.rising_time));
+        }
+
+    } else if (edges.rising_time != 0 && edges.falling_time != 0) {
+        /* Calculate zero-crossing time */
+        dimmer_state_set_zero_crossing(
+            (uint32_t)((edges.falling_time - edges.rising_time) / 2));
+    }
+}
+#endif
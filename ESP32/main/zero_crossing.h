@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+/**
+ * @brief Initializes the edge processing in the unlocked state.
+ *
+ * Must be called before the first edge is processed.
+ *
+ * @return void
+ */
+void zero_crossing_init(void);
+
+/**
+ * @brief Processes a zero-crossing edge, called from the edge capture ISR.
+ *
+ * Feeds the rising edges to the period tracker, publishes the edge snapshot
+ * and, with CONFIG_DIMMER_ISR_SCHEDULING, schedules the triggers of the
+ * window started by the edge with integer math only. Only depends on the
+ * timestamp of the edge, so it runs the same on the hardware capture and on
+ * replayed traces.
+ *
+ * @param current_time Timestamp of the edge in microseconds.
+ * @param current_state Level of the input after the edge.
+ *
+ * @return true if zero_crossing_schedule() must run after the edge.
+ */
+bool zero_crossing_edge(uint64_t current_time, bool current_state);
+
+/**
+ * @brief Handles a timeout of the edge watchdog, called from its ISR.
+ *
+ * The edges stopped for 1.5 periods: the gates are forced low, right away
+ * with CONFIG_DIMMER_ISR_SCHEDULING and by zero_crossing_schedule()
+ * otherwise. Once the silence outlasts the missing edges bridged by the
+ * period tracker, the mains is marked lost and the tracker drops its lock,
+ * keeping the filtered estimate to lock again quickly.
+ *
+ * @return true if zero_crossing_schedule() must run after the timeout.
+ */
+bool zero_crossing_timeout(void);
+
+#if !CONFIG_DIMMER_ISR_SCHEDULING
+/**
+ * @brief Schedules the triggers from the last edge snapshot.
+ *
+ * Runs on the control task after every edge and watchdog timeout, the
+ * values are latched by the
+ * firing engine on the next zero-crossing synchronization.
+ *
+ * @return void
+ */
+void zero_crossing_schedule(void);
+#endif